@@ -0,0 +1,77 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    argv_bench.cc
+ * @brief   Cost of building an argv of many arguments: the previous
+ *          find()/substr() splitting into vector<string> + vector<char*>
+ *          against the single-allocation ArgvArena
+ *          Options: [arguments] [iterations]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/argv_arena.h"
+
+namespace bench {
+
+// what InitializeCommand() and ConvertToChar() used to do
+static size_t LegacySplit(const std::string& cmd, std::string option) {
+  std::vector<std::string> v_command;
+  std::vector<char*> ch_command;
+  v_command.push_back(cmd);
+  while (true) {
+    size_t space_index = option.find(' ');
+    if (space_index == std::string::npos) {
+      v_command.push_back(option);
+      break;
+    }
+    std::string token = option.substr(0, space_index);
+    option = option.substr(space_index + 1);
+    if (token.length()) v_command.push_back(token);
+  }
+  for (auto& arg : v_command) ch_command.push_back(&arg[0]);
+  ch_command.push_back(nullptr);
+  return ch_command.size() - 1;
+}
+
+template <typename Function>
+static void Measure(const char* name, int iterations, Function build) {
+  size_t checksum = 0;
+  int64_t begin = NowNs();
+  for (int i = 0; i < iterations; ++i) checksum += build();
+  double us = (NowNs() - begin) / 1e3 / iterations;
+  Report(name, "us_per_build", us);
+  printf("%-20s %12.1f %10zu\n", name, us, checksum / iterations);
+}
+
+void ArgvBenchmark(int argc, char** argv) {
+  int arguments = argc > 0 ? atoi(argv[0]) : 10000;
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+  std::string option;
+  std::vector<std::string> list;
+  for (int i = 0; i < arguments; ++i) {
+    std::string arg = "argument_" + std::to_string(i);
+    option += (i ? " " : "") + arg;
+    list.push_back(arg);
+  }
+
+  printf("%-20s %12s %10s\n", "variant", "us/build", "argc");
+  Measure("legacy split", iterations,
+          [&] { return LegacySplit("cmd", option); });
+  Measure("arena split", iterations,
+          [&] { return ArgvArena::FromCommandLine("cmd", option).size(); });
+  Measure("arena shell words", iterations,
+          [&] { return ArgvArena::FromShellWords("cmd", option).size(); });
+  Measure("arena range", iterations,
+          [&] { return ArgvArena(list.begin(), list.end()).size(); });
+}
+
+}  // namespace bench
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    batch_bench.cc
+ * @brief   Spawns/sec of a loop of Subprocess constructors against
+ *          Subprocess::SpawnBatch() with one and several threads, every
+ *          command appending its output to the same file. The launches
+ *          dominate, expect the variants within a few percent per CPU
+ *          Options: [commands] [threads] [output file]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+// time to get every child started, then reap them untimed
+static void ReapAndReport(const char* name, std::vector<Subprocess>* batch,
+                          int64_t spawn_ns) {
+  size_t started = 0;
+  for (Subprocess& process : *batch) {
+    if (process.GetPID() == -1) continue;
+    ++started;
+    process.SubprocessWait();
+  }
+  Report(name, "spawn_us", spawn_ns / 1e3 / batch->size());
+  Report(name, "spawns_per_s", batch->size() / (spawn_ns / 1e9));
+  printf("%-22s %10zu %12.1f %12.1f\n", name, started,
+         spawn_ns / 1e3 / batch->size(), batch->size() / (spawn_ns / 1e9));
+}
+
+void BatchBenchmark(int argc, char** argv) {
+  int commands = argc > 0 ? atoi(argv[0]) : 1000;
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  std::string output_file = argc > 2 ? argv[2] : "/dev/null";
+
+  // PATH lookup is part of what is measured
+  std::vector<CommandSpec> specs(commands);
+  for (CommandSpec& spec : specs) {
+    spec.argv = {"true", "batch"};
+    spec.output_file = output_file;
+  }
+
+  printf("%-22s %10s %12s %12s\n", "variant", "started", "spawn_us",
+         "spawns/s");
+  {
+    std::vector<Subprocess> batch;
+    batch.reserve(commands);
+    int64_t begin = NowNs();
+    for (const CommandSpec& spec : specs) {
+      batch.emplace_back(spec.argv.begin(), spec.argv.end(), false);
+      batch.back().SendOutputToFile(spec.output_file);
+      batch.back().Start();
+    }
+    ReapAndReport("constructor loop", &batch, NowNs() - begin);
+  }
+  {
+    int64_t begin = NowNs();
+    std::vector<Subprocess> batch = Subprocess::SpawnBatch(specs);
+    ReapAndReport("SpawnBatch 1 thread", &batch, NowNs() - begin);
+  }
+  {
+    int64_t begin = NowNs();
+    std::vector<Subprocess> batch = Subprocess::SpawnBatch(specs, threads);
+    std::string name = "SpawnBatch " + std::to_string(threads) + " threads";
+    ReapAndReport(name.c_str(), &batch, NowNs() - begin);
+  }
+}
+
+}  // namespace bench
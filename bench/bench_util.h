@@ -0,0 +1,192 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    bench_util.h
+ * @brief   Helpers shared by the subprocess benchmarks
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef SUBPROCESS_BENCH_BENCH_UTIL_H_
+#define SUBPROCESS_BENCH_BENCH_UTIL_H_
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// subprocess_bench runs itself with this to print the time it exits
+#define EXIT_STAMP_OPTION "--exit-stamp"
+
+namespace bench {
+
+inline int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// MemAvailable from /proc/meminfo in bytes, 0 if unknown
+inline size_t MemAvailable() {
+  FILE* fp = fopen("/proc/meminfo", "r");
+  if (!fp) return 0;
+  char line[256];
+  size_t kb = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "MemAvailable: %zu kB", &kb) == 1) break;
+  }
+  fclose(fp);
+  return kb * 1024;
+}
+
+/*!
+ * Grows the resident set of the benchmark process by touching an
+ * anonymous mapping, so that fork-like launches have real page
+ * tables to copy.
+ */
+class RssBallast {
+ public:
+  explicit RssBallast(size_t bytes) : size_(bytes) {
+    if (!size_) return;
+    void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      size_ = 0;
+      return;
+    }
+    addr_ = static_cast<char*>(p);
+    memset(addr_, 1, size_);
+  }
+  ~RssBallast() {
+    if (addr_) munmap(addr_, size_);
+  }
+  RssBallast(const RssBallast&) = delete;
+  RssBallast& operator=(const RssBallast&) = delete;
+
+  bool ok() const { return addr_ != nullptr || size_ == 0; }
+
+ private:
+  char* addr_ = nullptr;
+  size_t size_;
+};
+
+/// Soft RLIMIT_NOFILE up to the hard limit, for suites with many children
+inline void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+inline std::string HumanBytes(size_t bytes) {
+  char buf[32];
+  if (bytes >= (size_t(1) << 30))
+    snprintf(buf, sizeof(buf), "%zuGB", bytes >> 30);
+  else
+    snprintf(buf, sizeof(buf), "%zuMB", bytes >> 20);
+  return buf;
+}
+
+/*!
+ * Every number the suites print, kept so that main() can write them as
+ * JSON for comparing runs, e.g. of two commits
+ */
+class Results {
+ public:
+  static Results& Instance() {
+    static Results results;
+    return results;
+  }
+
+  /// Suite the following Add() calls belong to
+  void SetSuite(const std::string& suite) { suite_ = suite; }
+
+  /// name identifies the measurement within its suite, e.g. "clone3/1GB"
+  void Add(const std::string& name, const std::string& metric,
+           double value) {
+    entries_.push_back(Entry{suite_, name, metric, value});
+  }
+
+  /*!
+   * {"context": {...}, "results": [{"suite", "name", "metric", "value"}]}
+   * with the host, kernel, CPU count and time of the run as context
+   */
+  bool WriteJson(FILE* fp) const {
+    struct utsname host;
+    uname(&host);
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(fp, "{\n  \"context\": {\"date\": %s, \"host\": %s, "
+            "\"kernel\": %s, \"cpus\": %ld},\n  \"results\": [",
+            Quote(date).c_str(), Quote(host.nodename).c_str(),
+            Quote(host.release).c_str(), sysconf(_SC_NPROCESSORS_ONLN));
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      const Entry& entry = entries_[i];
+      fprintf(fp, "%s\n    {\"suite\": %s, \"name\": %s, \"metric\": %s, "
+              "\"value\": %.6g}", i ? "," : "", Quote(entry.suite).c_str(),
+              Quote(entry.name).c_str(), Quote(entry.metric).c_str(),
+              entry.value);
+    }
+    return fprintf(fp, "\n  ]\n}\n") > 0;
+  }
+
+ private:
+  struct Entry {
+    std::string suite;
+    std::string name;
+    std::string metric;
+    double value;
+  };
+
+  static std::string Quote(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+      if (c == '"' || c == '\\') quoted += '\\';
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  std::string suite_;
+  std::vector<Entry> entries_;
+};
+
+/// Shorthand for Results::Instance().Add()
+inline void Report(const std::string& name, const std::string& metric,
+                   double value) {
+  Results::Instance().Add(name, metric, value);
+}
+
+// Benchmark suites, one function per area
+void SpawnBenchmark(int argc, char** argv);
+void ReactorBenchmark(int argc, char** argv);
+void PipelineBenchmark(int argc, char** argv);
+void SpliceBenchmark(int argc, char** argv);
+void PoolBenchmark(int argc, char** argv);
+void ArgvBenchmark(int argc, char** argv);
+void UringBenchmark(int argc, char** argv);
+void BatchBenchmark(int argc, char** argv);
+void PathBenchmark(int argc, char** argv);
+void TraceBenchmark(int argc, char** argv);
+void RecordBenchmark(int argc, char** argv);
+void WaitBenchmark(int argc, char** argv);
+void IoBenchmark(int argc, char** argv);
+void EnvBenchmark(int argc, char** argv);
+void RegistryBenchmark(int argc, char** argv);
+
+}  // namespace bench
+
+#endif  // SUBPROCESS_BENCH_BENCH_UTIL_H_
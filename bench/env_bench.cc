@@ -0,0 +1,79 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    env_bench.cc
+ * @brief   Cost per child of running a command with extra environment
+ *          variables in another directory: through an env or sh wrapper
+ *          against a shared Environment and SetWorkingDirectory()
+ *          Options: [iterations] [variables]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+
+#include "bench_util.h"
+#include "dtu/common/environment.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+static void Measure(const char* name, int iterations,
+                    std::function<Subprocess()> create) {
+  int64_t begin = NowNs();
+  for (int i = 0; i < iterations; ++i) {
+    Subprocess process = create();
+    process.Start();
+    process.SubprocessWait();
+  }
+  double us = (NowNs() - begin) / 1e3 / iterations;
+  Report(name, "us_per_child", us);
+  printf("%-22s %12.1f\n", name, us);
+}
+
+void EnvBenchmark(int argc, char** argv) {
+  int iterations = argc > 0 ? atoi(argv[0]) : 500;
+  int variables = argc > 1 ? atoi(argv[1]) : 4;
+  bool start_execution = false;
+
+  std::string assignments;
+  EnvironmentBuilder builder = EnvironmentBuilder::FromParent();
+  for (int i = 0; i < variables; ++i) {
+    std::string name = "BENCH_VARIABLE_" + std::to_string(i);
+    assignments += " " + name + "=value";
+    builder.Set(name, "value");
+  }
+  std::shared_ptr<const Environment> environment = builder.Build();
+
+  printf("%-22s %12s\n", "variant", "us/child");
+  Measure("inherited", iterations, [&] {
+    return Subprocess("true", "", start_execution);
+  });
+  Measure("sh -c cd && exec", iterations, [&] {
+    return Subprocess(
+        "sh", "-c 'cd /tmp &&" + assignments + " exec true'",
+        start_execution, kShellWords);
+  });
+  Measure("env -C", iterations, [&] {
+    return Subprocess("env", "-C /tmp" + assignments + " true",
+                      start_execution);
+  });
+  Measure("shared Environment", iterations, [&] {
+    Subprocess process("true", "", start_execution);
+    process.SetEnvironment(environment);
+    process.SetWorkingDirectory("/tmp");
+    return process;
+  });
+  Measure("Environment per child", iterations, [&] {
+    Subprocess process("true", "", start_execution);
+    process.SetEnvironment(builder.Build());
+    process.SetWorkingDirectory("/tmp");
+    return process;
+  });
+}
+
+}  // namespace bench
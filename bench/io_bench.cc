@@ -0,0 +1,79 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    io_bench.cc
+ * @brief   Throughput of the stdout of a child writing zeros through
+ *          each output path: a file, a pipe read by the parent, the
+ *          in-memory capture of RunAndCapture() and Communicate() into
+ *          a second child
+ *          Options: [MB written]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+#define IO_BENCH_FILE "/tmp/subprocess_io_bench.dat"
+
+static void Measure(const char* name, size_t bytes,
+                    std::function<size_t(Subprocess&)> drain) {
+  bool start_execution = false;
+  Subprocess source("head", "-c " + std::to_string(bytes) + " /dev/zero",
+                    start_execution);
+  int64_t begin = NowNs();
+  size_t received = drain(source);
+  double seconds = (NowNs() - begin) / 1e9;
+
+  double megabytes_per_s = (bytes >> 20) / seconds;
+  Report(name, "MB_per_s", megabytes_per_s);
+  printf("%-16s %12zu %10.3f %10.1f\n", name, received, seconds,
+         megabytes_per_s);
+}
+
+void IoBenchmark(int argc, char** argv) {
+  size_t megabytes = argc > 0 ? strtoull(argv[0], nullptr, 10) : 256;
+  size_t bytes = megabytes << 20;
+
+  printf("%-16s %12s %10s %10s\n", "path", "bytes", "seconds", "MB/s");
+  Measure("file", bytes, [bytes](Subprocess& source) {
+    unlink(IO_BENCH_FILE);
+    source.SendOutputToFile(IO_BENCH_FILE);
+    source.Start();
+    source.SubprocessWait();
+    unlink(IO_BENCH_FILE);
+    return bytes;
+  });
+  Measure("pipe", bytes, [](Subprocess& source) {
+    source.SendOutputToPipe();
+    source.Start();
+    std::vector<char> buffer(1 << 16);
+    size_t received = 0;
+    ssize_t size;
+    while ((size = read(source.GetOutputFD(), buffer.data(),
+                        buffer.size())) > 0) {
+      received += size;
+    }
+    source.SubprocessWait();
+    return received;
+  });
+  Measure("RunAndCapture", bytes, [](Subprocess& source) {
+    return source.RunAndCapture().output.size();
+  });
+  Measure("Communicate", bytes, [bytes](Subprocess& source) {
+    Subprocess sink("cat", "", false);
+    sink.SendOutputToFile(nullptr);
+    source.Communicate(sink);
+    return bytes;
+  });
+}
+
+}  // namespace bench
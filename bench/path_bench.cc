@@ -0,0 +1,86 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    path_bench.cc
+ * @brief   Cost of finding the executable in a long PATH: children
+ *          searching it with execvp() against the parent ExecutableCache.
+ *          The PATH holds empty directories, or missing ones that the
+ *          cache checks by mtime, followed by the real one
+ *          Options: [iterations] [PATH entries]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "bench_util.h"
+#include "dtu/common/executable_cache.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+static void Measure(const char* name, int iterations, bool cached,
+                    int child_execs) {
+  ExecutableCache& cache = ExecutableCache::Instance();
+  cache.SetEnabled(cached);
+  uint64_t syscalls = cache.SyscallCount();
+
+  int64_t spawn_ns = 0;
+  for (int i = 0; i < iterations; ++i) {
+    Subprocess process("true", "", false);
+    int64_t begin = NowNs();
+    process.Start();
+    spawn_ns += NowNs() - begin;
+    process.SubprocessWait();
+  }
+  double parent = double(cache.SyscallCount() - syscalls) / iterations;
+  Report(name, "spawn_us", spawn_ns / 1e3 / iterations);
+  Report(name, "parent_syscalls_per_spawn", parent);
+  printf("%-22s %10.1f %12.1f %14.1f %14d\n", name,
+         spawn_ns / 1e3 / iterations, iterations / (spawn_ns / 1e9), parent,
+         child_execs);
+}
+
+void PathBenchmark(int argc, char** argv) {
+  int iterations = argc > 0 ? atoi(argv[0]) : 1000;
+  int entries = argc > 1 ? atoi(argv[1]) : 20;
+
+  std::string root = "/tmp/path_bench." + std::to_string(getpid());
+  mkdir(root.c_str(), 0700);
+  std::string empty_path, missing_path;
+  for (int i = 0; i < entries - 1; ++i) {
+    std::string dir = root + "/" + std::to_string(i);
+    mkdir(dir.c_str(), 0700);
+    empty_path += dir + ":";
+    missing_path += root + "/missing" + std::to_string(i) + ":";
+  }
+  const char* true_dir = access("/usr/bin/true", X_OK) == 0 ? "/usr/bin"
+                                                            : "/bin";
+  empty_path += true_dir;
+  missing_path += true_dir;
+
+  std::string saved_path = getenv("PATH") ? getenv("PATH") : "";
+  printf("%-22s %10s %12s %14s %14s\n", "variant", "spawn_us", "spawns/s",
+         "parent_sys/sp", "child_execs/sp");
+  // execvp() tries every entry up to the one holding the executable
+  setenv("PATH", empty_path.c_str(), 1);
+  Measure("execvp, empty dirs", iterations, false, entries);
+  Measure("cache, empty dirs", iterations, true, 1);
+  setenv("PATH", missing_path.c_str(), 1);
+  Measure("execvp, missing dirs", iterations, false, entries);
+  Measure("cache, missing dirs", iterations, true, 1);
+  setenv("PATH", saved_path.c_str(), 1);
+
+  for (int i = 0; i < entries - 1; ++i) {
+    rmdir((root + "/" + std::to_string(i)).c_str());
+  }
+  rmdir(root.c_str());
+}
+
+}  // namespace bench
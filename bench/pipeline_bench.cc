@@ -0,0 +1,82 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    pipeline_bench.cc
+ * @brief   Throughput of a multi-stage Pipeline compared with the
+ *          same chain run by /bin/sh -c
+ *          Options: [MB pushed] [cat stages]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/pipeline.h"
+
+namespace bench {
+
+static double RunPipeline(size_t megabytes, int cat_stages, int capacity) {
+  std::vector<std::unique_ptr<Subprocess>> stages;
+  stages.emplace_back(new Subprocess(
+      "head", "-c " + std::to_string(megabytes << 20) + " /dev/zero", false));
+  for (int i = 0; i < cat_stages; ++i) {
+    stages.emplace_back(new Subprocess("cat", "", false));
+  }
+  stages.back()->SendOutputToFile(nullptr);
+
+  Pipeline pipeline;
+  for (auto& stage : stages) pipeline.Add(*stage);
+  pipeline.SetPipeCapacity(capacity);
+
+  int64_t begin = NowNs();
+  pipeline.Start();
+  pipeline.Wait();
+  return (NowNs() - begin) / 1e9;
+}
+
+static double RunShell(size_t megabytes, int cat_stages) {
+  std::string chain = "head -c " + std::to_string(megabytes << 20) +
+                      " /dev/zero";
+  for (int i = 0; i < cat_stages; ++i) chain += " | cat";
+  chain += " > /dev/null";
+
+  // the option tokenizer splits on spaces, so exec sh directly
+  const char* argv[] = {"/bin/sh", "-c", chain.c_str(), nullptr};
+  int64_t begin = NowNs();
+  pid_t pid = fork();
+  if (pid == 0) {
+    execv(argv[0], const_cast<char**>(argv));
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return (NowNs() - begin) / 1e9;
+}
+
+void PipelineBenchmark(int argc, char** argv) {
+  size_t megabytes = argc > 0 ? strtoull(argv[0], nullptr, 10) : 2048;
+  int cat_stages = argc > 1 ? atoi(argv[1]) : 3;
+  double gigabytes = megabytes / 1024.0;
+
+  printf("%-24s %10s %10s\n", "variant", "seconds", "GB/s");
+  double seconds = RunShell(megabytes, cat_stages);
+  Report("sh -c", "GB_per_s", gigabytes / seconds);
+  printf("%-24s %10.3f %10.2f\n", "sh -c", seconds, gigabytes / seconds);
+
+  const int kCapacities[] = {0, 1 << 20};
+  for (int capacity : kCapacities) {
+    seconds = RunPipeline(megabytes, cat_stages, capacity);
+    std::string name = "pipeline pipe=" +
+        (capacity ? std::to_string(capacity >> 10) + "KB" : "default");
+    Report(name, "GB_per_s", gigabytes / seconds);
+    printf("%-24s %10.3f %10.2f\n", name.c_str(), seconds,
+           gigabytes / seconds);
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    pool_bench.cc
+ * @brief   Jobs/sec of a SubprocessPool of warm workers against
+ *          spawning the tool for every job
+ *          Options: [jobs] [caller threads]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess_pool.h"
+
+namespace bench {
+
+// run jobs from threads callers, each job through job_function
+template <typename Function>
+static double JobsPerSecond(int jobs, int threads, Function job_function) {
+  std::atomic<int> next(0);
+  int64_t begin = NowNs();
+  std::vector<std::thread> callers;
+  for (int t = 0; t < threads; ++t) {
+    callers.emplace_back([&] {
+      while (next++ < jobs) job_function();
+    });
+  }
+  for (auto& caller : callers) caller.join();
+  return jobs / ((NowNs() - begin) / 1e9);
+}
+
+void PoolBenchmark(int argc, char** argv) {
+  int jobs = argc > 0 ? atoi(argv[0]) : 5000;
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  const std::string job = "small job payload";
+
+  PoolOptions options;
+  options.workers = threads;
+  SubprocessPool pool("cat", "", options);
+  double pool_rate = JobsPerSecond(jobs, threads, [&] {
+    std::string response;
+    pool.Run(job, &response);
+  });
+  PoolStats stats = pool.Stats();
+
+  double spawn_rate = JobsPerSecond(jobs, threads, [&] {
+    Subprocess process("cat", "", false);
+    process.CommunicateWithInput(job + '\n');
+  });
+
+  Report("pool", "jobs_per_s", pool_rate);
+  Report("pool", "mean_latency_us", stats.mean_latency_us);
+  Report("spawn per job", "jobs_per_s", spawn_rate);
+  Report("spawn per job", "mean_latency_us", threads * 1e6 / spawn_rate);
+  printf("%-16s %12s %16s\n", "variant", "jobs/s", "mean_latency_us");
+  printf("%-16s %12.1f %16.1f\n", "pool", pool_rate, stats.mean_latency_us);
+  printf("%-16s %12.1f %16.1f\n", "spawn per job", spawn_rate,
+         threads * 1e6 / spawn_rate);
+}
+
+}  // namespace bench
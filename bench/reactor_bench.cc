@@ -0,0 +1,86 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    reactor_bench.cc
+ * @brief   Reap latency and reactor CPU use as the number of
+ *          concurrently supervised children grows
+ *          Options: [max children]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess_reactor.h"
+
+namespace bench {
+
+static double ThreadCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void ReactorBenchmark(int argc, char** argv) {
+  int max_children = argc > 0 ? atoi(argv[0]) : 10000;
+  // every child holds a pidfd in the process and one in the reactor
+  RaiseFileLimit();
+
+  printf("%8s %12s %12s %12s %12s\n", "children", "p50_us", "p99_us",
+         "max_us", "cpu_ms");
+  for (int children = 10; children <= max_children; children *= 10) {
+    // all children block on one pipe and exit together once it is closed
+    int release[2];
+    if (pipe2(release, O_CLOEXEC) != 0) return;
+
+    std::vector<std::unique_ptr<Subprocess>> processes;
+    for (int i = 0; i < children; ++i) {
+      std::unique_ptr<Subprocess> process(new Subprocess("cat", "", false));
+      process->ReceiveInputFromFile(release[0]);
+      process->SendOutputToFile(nullptr);
+      process->Start();
+      if (process->GetPID() == -1) break;
+      processes.push_back(std::move(process));
+    }
+    close(release[0]);
+
+    SubprocessReactor reactor;
+    std::vector<int64_t> latencies;
+    latencies.reserve(processes.size());
+    int64_t released_at = 0;
+    for (auto& process : processes) {
+      reactor.Watch(*process, [&](pid_t, int) {
+        latencies.push_back(NowNs() - released_at);
+      });
+    }
+
+    double cpu_before = ThreadCpuSeconds();
+    released_at = NowNs();
+    close(release[1]);
+    reactor.Run();
+    double cpu_ms = (ThreadCpuSeconds() - cpu_before) * 1e3;
+
+    if (latencies.empty()) continue;
+    std::sort(latencies.begin(), latencies.end());
+    std::string name = std::to_string(latencies.size()) + "children";
+    Report(name, "p50_us", latencies[latencies.size() / 2] / 1e3);
+    Report(name, "p99_us", latencies[latencies.size() * 99 / 100] / 1e3);
+    Report(name, "max_us", latencies.back() / 1e3);
+    Report(name, "cpu_ms", cpu_ms);
+    printf("%8zu %12.1f %12.1f %12.1f %12.2f\n", latencies.size(),
+           latencies[latencies.size() / 2] / 1e3,
+           latencies[latencies.size() * 99 / 100] / 1e3,
+           latencies.back() / 1e3, cpu_ms);
+  }
+}
+
+}  // namespace bench
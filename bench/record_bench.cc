@@ -0,0 +1,78 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    record_bench.cc
+ * @brief   Lines/sec parsing the stdout of a child writing short lines:
+ *          read() into a std::string split into one std::string per
+ *          line against RecordReader views
+ *          Options: [MB of output] [line]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <string>
+
+#include "bench_util.h"
+#include "dtu/common/record_reader.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+// what callers did before: append reads, cut a string per line
+static size_t SplitIntoStrings(int fd, size_t* bytes) {
+  std::string pending;
+  char chunk[65536];
+  size_t lines = 0;
+  ssize_t size;
+  while ((size = read(fd, chunk, sizeof(chunk))) > 0) {
+    pending.append(chunk, size);
+    size_t begin = 0, end;
+    while ((end = pending.find('\n', begin)) != std::string::npos) {
+      std::string line = pending.substr(begin, end - begin);
+      *bytes += line.size();
+      ++lines;
+      begin = end + 1;
+    }
+    pending.erase(0, begin);
+  }
+  return lines;
+}
+
+static size_t ReadRecords(int fd, size_t* bytes) {
+  RecordReader reader(fd);
+  RecordView line;
+  while (reader.Next(&line) == RecordReader::kRecord) *bytes += line.size;
+  return reader.Count();
+}
+
+template <typename Parser>
+static void Measure(const char* name, const std::string& option,
+                    Parser parse) {
+  Subprocess producer("sh", option, false, kShellWords);
+  producer.SendOutputToPipe();
+  int64_t begin = NowNs();
+  producer.Start();
+  size_t bytes = 0;
+  size_t lines = parse(producer.GetOutputFD(), &bytes);
+  producer.SubprocessWait();
+  double seconds = (NowNs() - begin) / 1e9;
+  Report(name, "lines_per_s", lines / seconds);
+  printf("%-16s %12zu %14.0f %10.1f\n", name, lines, lines / seconds,
+         (bytes >> 20) / seconds);
+}
+
+void RecordBenchmark(int argc, char** argv) {
+  size_t megabytes = argc > 0 ? strtoull(argv[0], nullptr, 10) : 1024;
+  std::string line = argc > 1 ? argv[1] : "main.cc:12:3: warning: unused";
+
+  std::string option = "-c 'yes \"" + line + "\" | head -c " +
+                       std::to_string(megabytes << 20) + "'";
+  printf("%-16s %12s %14s %10s\n", "reader", "lines", "lines/s", "MB/s");
+  Measure("string split", option, SplitIntoStrings);
+  Measure("RecordReader", option, ReadRecords);
+}
+
+}  // namespace bench
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    registry_bench.cc
+ * @brief   Wait latency with many children exiting at once, reaped by
+ *          waitpid() in the waiting thread or by the ChildRegistry
+ *          Options: [children]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+void RegistryBenchmark(int argc, char** argv) {
+  int children = argc > 0 ? atoi(argv[0]) : 10000;
+  // a pidfd per child, handed over to the registry when it is used
+  RaiseFileLimit();
+
+  printf("%-10s %8s %12s %12s %12s %12s\n", "reaper", "children", "p50_us",
+         "p99_us", "max_us", "total_ms");
+  for (bool registry : {false, true}) {
+    // all children block on one pipe and exit together once it is closed
+    int release[2];
+    if (pipe2(release, O_CLOEXEC) != 0) return;
+
+    std::vector<std::unique_ptr<Subprocess>> processes;
+    for (int i = 0; i < children; ++i) {
+      std::unique_ptr<Subprocess> process(new Subprocess("cat", "", false));
+      process->SetLaunchBackend(kClone3);
+      if (registry) process->UseChildRegistry();
+      process->ReceiveInputFromFile(release[0]);
+      process->SendOutputToFile(nullptr);
+      process->Start();
+      if (process->GetPID() == -1) break;
+      processes.push_back(std::move(process));
+    }
+    close(release[0]);
+
+    // each exit is seen when SubprocessWait() returns, in launch order
+    std::vector<int64_t> latencies;
+    latencies.reserve(processes.size());
+    int64_t released_at = NowNs();
+    close(release[1]);
+    for (auto& process : processes) {
+      process->SubprocessWait();
+      latencies.push_back(NowNs() - released_at);
+    }
+    int64_t total = NowNs() - released_at;
+
+    if (latencies.empty()) continue;
+    std::sort(latencies.begin(), latencies.end());
+    const char* reaper = registry ? "registry" : "waitpid";
+    std::string name = std::string(reaper) + "/" +
+                       std::to_string(latencies.size()) + "children";
+    Report(name, "p50_us", latencies[latencies.size() / 2] / 1e3);
+    Report(name, "p99_us", latencies[latencies.size() * 99 / 100] / 1e3);
+    Report(name, "max_us", latencies.back() / 1e3);
+    Report(name, "total_ms", total / 1e6);
+    printf("%-10s %8zu %12.1f %12.1f %12.1f %12.2f\n", reaper,
+           latencies.size(), latencies[latencies.size() / 2] / 1e3,
+           latencies[latencies.size() * 99 / 100] / 1e3,
+           latencies.back() / 1e3, total / 1e6);
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,115 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    spawn_bench.cc
+ * @brief   Spawn latency and spawns/sec of each launch backend,
+ *          including the spawn server, as the parent RSS grows and as
+ *          more threads spawn at the same time
+ *          Options: [iterations] [max ballast in MB] [max threads]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/spawn_server.h"
+#include "dtu/common/subprocess.h"
+
+namespace bench {
+
+static const struct {
+  LaunchBackend backend;
+  const char* name;
+} kBackends[] = {{kPosixSpawn, "posix_spawn"},
+                 {kClone3, "clone3"},
+                 {kVfork, "vfork"},
+                 {kSpawnServer, "spawn_server"}};
+
+// nanoseconds spent in Start() by iterations spawns of /bin/true
+static int64_t SpawnLoop(LaunchBackend backend, int iterations) {
+  int64_t spawn_ns = 0;
+  for (int i = 0; i < iterations; ++i) {
+    Subprocess process("/bin/true", "", false);
+    process.SetLaunchBackend(backend);
+    int64_t t0 = NowNs();
+    process.Start();
+    spawn_ns += NowNs() - t0;
+    process.SubprocessWait();
+  }
+  return spawn_ns;
+}
+
+// every thread runs its own SpawnLoop() at the same time
+static void SpawnFromThreads(int iterations, int max_threads) {
+  printf("\n%-8s %-12s %14s %14s\n", "threads", "backend", "spawn_us",
+         "spawns/s");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    for (const auto& b : kBackends) {
+      std::atomic<int64_t> spawn_ns(0);
+      std::vector<std::thread> workers;
+      int64_t begin = NowNs();
+      for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&spawn_ns, &b, iterations] {
+          spawn_ns += SpawnLoop(b.backend, iterations);
+        });
+      }
+      for (std::thread& worker : workers) worker.join();
+      double total_s = (NowNs() - begin) / 1e9;
+      int spawns = iterations * threads;
+
+      std::string name = std::string(b.name) + "/" +
+                         std::to_string(threads) + "threads";
+      Report(name, "spawn_us", spawn_ns / 1e3 / spawns);
+      Report(name, "spawns_per_s", spawns / total_s);
+      printf("%-8d %-12s %14.1f %14.1f\n", threads, b.name,
+             spawn_ns / 1e3 / spawns, spawns / total_s);
+    }
+  }
+}
+
+void SpawnBenchmark(int argc, char** argv) {
+  int iterations = argc > 0 ? atoi(argv[0]) : 200;
+  size_t max_ballast = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 10240)
+                       << 20;
+  int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+  const size_t kBallast[] = {size_t(10) << 20, size_t(100) << 20,
+                             size_t(1) << 30, size_t(10) << 30};
+
+  // forked while the benchmark is still small, like a real service would
+  SpawnServer::Instance().Start();
+
+  printf("%-8s %-12s %14s %14s\n", "rss", "backend", "spawn_us", "spawns/s");
+  for (size_t ballast_size : kBallast) {
+    if (ballast_size > max_ballast) break;
+    // keep a margin so the benchmark itself is not OOM killed
+    if (ballast_size > MemAvailable() / 10 * 8) {
+      printf("%-8s skipped, not enough memory\n",
+             HumanBytes(ballast_size).c_str());
+      continue;
+    }
+    RssBallast ballast(ballast_size);
+    if (!ballast.ok()) continue;
+
+    for (const auto& b : kBackends) {
+      int64_t begin = NowNs();
+      int64_t spawn_ns = SpawnLoop(b.backend, iterations);
+      double total_s = (NowNs() - begin) / 1e9;
+
+      std::string name = std::string(b.name) + "/" + HumanBytes(ballast_size);
+      Report(name, "spawn_us", spawn_ns / 1e3 / iterations);
+      Report(name, "spawns_per_s", iterations / total_s);
+      printf("%-8s %-12s %14.1f %14.1f\n", HumanBytes(ballast_size).c_str(),
+             b.name, spawn_ns / 1e3 / iterations, iterations / total_s);
+    }
+  }
+
+  SpawnFromThreads(iterations, max_threads);
+}
+
+}  // namespace bench
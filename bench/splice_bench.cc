@@ -0,0 +1,109 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    splice_bench.cc
+ * @brief   Parent CPU time per GB when feeding a file to a child and
+ *          draining a child to a file, read()/write() against splice()
+ *          Options: [MB moved]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <sys/resource.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_splice.h"
+
+namespace bench {
+
+#define SPLICE_BENCH_FILE "/tmp/subprocess_splice_bench.dat"
+
+static double ProcessCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static ssize_t ReadWriteCopy(int in_fd, int out_fd) {
+  std::vector<char> buffer(1 << 16);
+  ssize_t total = 0;
+  ssize_t size;
+  while ((size = read(in_fd, buffer.data(), buffer.size())) > 0) {
+    for (ssize_t done = 0; done < size;) {
+      ssize_t written = write(out_fd, buffer.data() + done, size - done);
+      if (written <= 0) return total;
+      done += written;
+    }
+    total += size;
+  }
+  return total;
+}
+
+static void ReportCpu(const char* name, size_t bytes, double cpu_seconds) {
+  double gigabytes = bytes / double(1 << 30);
+  Report(name, "cpu_ms_per_GB", cpu_seconds * 1e3 / gigabytes);
+  printf("%-20s %12.1f\n", name, cpu_seconds * 1e3 / gigabytes);
+}
+
+void SpliceBenchmark(int argc, char** argv) {
+  size_t megabytes = argc > 0 ? strtoull(argv[0], nullptr, 10) : 1024;
+  size_t bytes = megabytes << 20;
+
+  // source file, written once so both variants read from the page cache
+  int fd = open(SPLICE_BENCH_FILE, O_CREAT | O_TRUNC | O_WRONLY, 0640);
+  std::vector<char> block(1 << 20, 'x');
+  for (size_t i = 0; i < megabytes; ++i) {
+    if (write(fd, block.data(), block.size()) < 0) break;
+  }
+  close(fd);
+
+  printf("%-20s %12s\n", "variant", "cpu_ms/GB");
+  for (int use_splice = 0; use_splice < 2; ++use_splice) {
+    Subprocess sink("cat", "", false);
+    sink.ReceiveInputFromPipe();
+    sink.SendOutputToFile(nullptr);
+    sink.Start();
+    int in_fd = open(SPLICE_BENCH_FILE, O_RDONLY);
+
+    double before = ProcessCpuSeconds();
+    if (use_splice) {
+      SpliceStream(in_fd, sink.GetInputFD());
+    } else {
+      ReadWriteCopy(in_fd, sink.GetInputFD());
+    }
+    double cpu = ProcessCpuSeconds() - before;
+    close(in_fd);
+    sink.CloseInput();
+    sink.SubprocessWait();
+    ReportCpu(use_splice ? "feed splice" : "feed read/write", bytes, cpu);
+  }
+
+  for (int use_splice = 0; use_splice < 2; ++use_splice) {
+    Subprocess source("head", "-c " + std::to_string(bytes) + " /dev/zero",
+                      false);
+    source.SendOutputToPipe();
+    source.Start();
+    int out_fd = open(SPLICE_BENCH_FILE, O_TRUNC | O_WRONLY);
+
+    double before = ProcessCpuSeconds();
+    if (use_splice) {
+      SpliceStream(source.GetOutputFD(), out_fd);
+    } else {
+      ReadWriteCopy(source.GetOutputFD(), out_fd);
+    }
+    double cpu = ProcessCpuSeconds() - before;
+    close(out_fd);
+    source.SubprocessWait();
+    ReportCpu(use_splice ? "drain splice" : "drain read/write", bytes, cpu);
+  }
+  unlink(SPLICE_BENCH_FILE);
+}
+
+}  // namespace bench
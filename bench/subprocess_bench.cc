@@ -0,0 +1,84 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_bench.cc
+ * @brief   Entry point of the subprocess benchmarks
+ *          Usage: subprocess_bench [--json file] [suite] [suite options]
+ *          Without a suite every suite runs with its defaults. --json
+ *          also writes every result to file, "-" for stdout.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstring>
+
+#include "bench_util.h"
+
+struct Suite {
+  const char* name;
+  void (*run)(int argc, char** argv);
+};
+
+static const Suite kSuites[] = {
+  {"spawn", bench::SpawnBenchmark},
+  {"wait", bench::WaitBenchmark},
+  {"io", bench::IoBenchmark},
+  {"reactor", bench::ReactorBenchmark},
+  {"pipeline", bench::PipelineBenchmark},
+  {"splice", bench::SpliceBenchmark},
+  {"pool", bench::PoolBenchmark},
+  {"argv", bench::ArgvBenchmark},
+  {"uring", bench::UringBenchmark},
+  {"batch", bench::BatchBenchmark},
+  {"path", bench::PathBenchmark},
+  {"trace", bench::TraceBenchmark},
+  {"record", bench::RecordBenchmark},
+  {"env", bench::EnvBenchmark},
+  {"registry", bench::RegistryBenchmark},
+};
+
+int main(int argc, char** argv) {
+  // child of the wait suite: print when it exits
+  if (argc > 1 && strcmp(argv[1], EXIT_STAMP_OPTION) == 0) {
+    printf("%lld\n", static_cast<long long>(bench::NowNs()));
+    return 0;
+  }
+
+  const char* json_file = nullptr;
+  if (argc > 2 && strcmp(argv[1], "--json") == 0) {
+    json_file = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+
+  const char* selected = argc > 1 ? argv[1] : nullptr;
+  int suite_argc = argc > 1 ? argc - 2 : 0;
+  char** suite_argv = argc > 1 ? argv + 2 : argv + argc;
+
+  bool found = false;
+  for (const Suite& suite : kSuites) {
+    if (selected && strcmp(selected, suite.name) != 0) continue;
+    found = true;
+    printf("== %s ==\n", suite.name);
+    bench::Results::Instance().SetSuite(suite.name);
+    suite.run(suite_argc, suite_argv);
+    fflush(stdout);
+  }
+  if (!found) {
+    fprintf(stderr, "unknown suite %s\n", selected);
+    return 1;
+  }
+
+  if (json_file) {
+    bool to_stdout = strcmp(json_file, "-") == 0;
+    FILE* fp = to_stdout ? stdout : fopen(json_file, "w");
+    if (!fp || !bench::Results::Instance().WriteJson(fp)) {
+      fprintf(stderr, "can not write %s\n", json_file);
+      return 1;
+    }
+    if (!to_stdout) fclose(fp);
+  }
+  return 0;
+}
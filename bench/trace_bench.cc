@@ -0,0 +1,73 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    trace_bench.cc
+ * @brief   Overhead of the lifecycle hooks: spawn and wait with no
+ *          observer, with SubprocessMetrics and with ChromeTraceWriter,
+ *          and the cost of a disabled hook on its own
+ *          Options: [iterations] [trace file]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <cstdlib>
+#include <string>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_trace.h"
+
+namespace bench {
+
+static double SpawnAndWaitUs(int iterations) {
+  int64_t begin = NowNs();
+  for (int i = 0; i < iterations; ++i) {
+    Subprocess process("/bin/true", "", false);
+    process.Start();
+    process.WaitForExit();
+  }
+  return (NowNs() - begin) / 1e3 / iterations;
+}
+
+static void PrintSpawnAndWait(const char* observer, int iterations) {
+  double us = SpawnAndWaitUs(iterations);
+  Report(observer, "us_per_child", us);
+  printf("%-14s %12.1f\n", observer, us);
+}
+
+void TraceBenchmark(int argc, char** argv) {
+  int iterations = argc > 0 ? atoi(argv[0]) : 1000;
+  std::string trace_file = argc > 1 ? argv[1] : "/tmp/subprocess_trace.json";
+
+  // what every hook costs while nothing observes
+  const int kChecks = 100000000;
+  int enabled = 0;
+  int64_t begin = NowNs();
+  for (int i = 0; i < kChecks; ++i) {
+    enabled += SubprocessTrace::Enabled();
+    __asm__ __volatile__("" : "+r"(enabled));
+  }
+  double hook_ns = double(NowNs() - begin) / kChecks;
+  Report("disabled hook", "ns", hook_ns);
+  printf("disabled hook: %.3f ns\n", hook_ns);
+
+  printf("%-14s %12s\n", "observer", "us/child");
+  PrintSpawnAndWait("none", iterations);
+
+  SubprocessMetrics metrics;
+  SubprocessTrace::SetObserver(&metrics);
+  PrintSpawnAndWait("metrics", iterations);
+  SubprocessTrace::SetObserver(nullptr);
+
+  {
+    ChromeTraceWriter writer(trace_file);
+    SubprocessTrace::SetObserver(&writer);
+    PrintSpawnAndWait("chrome trace", iterations);
+    SubprocessTrace::SetObserver(nullptr);
+  }
+  printf("%s", metrics.Summary().c_str());
+}
+
+}  // namespace bench
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    uring_bench.cc
+ * @brief   Output capture from many chatty children, epoll reactor
+ *          against the io_uring engine: system calls per second and
+ *          CPU time per MB in the supervising process
+ *          Options: [children] [KB per child]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <sys/resource.h>
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess_reactor.h"
+#include "dtu/common/subprocess_uring.h"
+
+namespace bench {
+
+// io_uring workers are threads of this process, count all of them
+static double ProcessCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+template <typename Engine>
+static void CaptureRun(const char* name, int children, size_t kilobytes) {
+  Engine engine;
+  std::vector<std::unique_ptr<Subprocess>> processes;
+  size_t bytes = 0;
+  int exited = 0;
+
+  double cpu_before = ProcessCpuSeconds();
+  int64_t begin = NowNs();
+  for (int i = 0; i < children; ++i) {
+    std::unique_ptr<Subprocess> process(new Subprocess(
+        "head", "-c " + std::to_string(kilobytes << 10) + " /dev/zero",
+        false));
+    process->SendOutputToPipe();
+    process->Start();
+    if (process->GetPID() == -1) break;
+    engine.WatchOutput(process->GetOutputFD(),
+                       [&bytes](int, const char*, size_t size) {
+      bytes += size;
+    });
+    engine.Watch(*process, [&exited](pid_t, int) { ++exited; });
+    processes.push_back(std::move(process));
+  }
+  engine.Run();
+  double seconds = (NowNs() - begin) / 1e9;
+  double cpu_ms = (ProcessCpuSeconds() - cpu_before) * 1e3;
+
+  double megabytes = bytes / 1048576.0;
+  uint64_t syscalls = engine.SyscallCount();
+  std::string run = std::string(name) + "/" + std::to_string(exited) +
+                    "children";
+  Report(run, "wall_ms", seconds * 1e3);
+  Report(run, "syscalls_per_MB", syscalls / megabytes);
+  Report(run, "cpu_ms_per_MB", cpu_ms / megabytes);
+  printf("%-10s %8d %10.1f %10.1f %12llu %14.0f %12.1f %12.3f\n", name,
+         exited, megabytes, seconds * 1e3,
+         static_cast<unsigned long long>(syscalls), syscalls / seconds,
+         syscalls / megabytes, cpu_ms / megabytes);
+}
+
+void UringBenchmark(int argc, char** argv) {
+  int children = argc > 0 ? atoi(argv[0]) : 1000;
+  size_t kilobytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024;
+  // every child holds an output pipe and a pidfd
+  RaiseFileLimit();
+
+  {
+    SubprocessUring probe;
+    printf("io_uring: %s, waitid: %s\n", probe.UsesUring() ? "yes" : "no",
+           probe.UsesWaitid() ? "yes" : "no");
+  }
+  printf("%-10s %8s %10s %10s %12s %14s %12s %12s\n", "engine", "children",
+         "MB", "wall_ms", "syscalls", "syscalls/s", "syscalls/MB",
+         "cpu_ms/MB");
+  CaptureRun<SubprocessReactor>("epoll", children, kilobytes);
+  CaptureRun<SubprocessUring>("io_uring", children, kilobytes);
+}
+
+}  // namespace bench
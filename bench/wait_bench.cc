@@ -0,0 +1,80 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    wait_bench.cc
+ * @brief   Wait latency, from the exit of a child to its reaping by
+ *          each way of waiting. The child is this benchmark run with
+ *          EXIT_STAMP_OPTION, printing the time right before it exits.
+ *          Options: [iterations]
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <limits.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "bench_util.h"
+#include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_reactor.h"
+
+namespace bench {
+
+// time printed by the child, read until EOF so the child is gone by then
+static int64_t ReadExitStamp(int fd) {
+  std::string stamp;
+  char buffer[64];
+  ssize_t size;
+  while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+    stamp.append(buffer, size);
+  }
+  return strtoll(stamp.c_str(), nullptr, 10);
+}
+
+static void Measure(const char* name, int iterations,
+                    std::function<void(Subprocess&)> wait) {
+  char self[PATH_MAX] = {0};
+  if (readlink("/proc/self/exe", self, sizeof(self) - 1) <= 0) return;
+
+  std::vector<int64_t> latencies;
+  for (int i = 0; i < iterations; ++i) {
+    Subprocess child({self, EXIT_STAMP_OPTION}, false);
+    child.SendOutputToPipe();
+    if (child.Start() != 0) return;
+    int64_t exited_at = ReadExitStamp(child.GetOutputFD());
+    wait(child);
+    latencies.push_back(NowNs() - exited_at);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double p50 = latencies[latencies.size() / 2] / 1e3;
+  double p99 = latencies[latencies.size() * 99 / 100] / 1e3;
+  Report(name, "p50_us", p50);
+  Report(name, "p99_us", p99);
+  printf("%-22s %12.1f %12.1f\n", name, p50, p99);
+}
+
+void WaitBenchmark(int argc, char** argv) {
+  int iterations = argc > 0 ? atoi(argv[0]) : 200;
+
+  printf("%-22s %12s %12s\n", "variant", "p50_us", "p99_us");
+  Measure("SubprocessWait", iterations,
+          [](Subprocess& child) { child.SubprocessWait(); });
+  Measure("WaitForExit", iterations,
+          [](Subprocess& child) { child.WaitForExit(); });
+  Measure("WaitForGivenTime", iterations, [](Subprocess& child) {
+    child.SubprocessWaitForGivenTime(std::chrono::seconds(10));
+  });
+  SubprocessReactor reactor;
+  Measure("SubprocessReactor", iterations, [&reactor](Subprocess& child) {
+    reactor.Watch(child, [](pid_t, int) {});
+    reactor.Run();
+  });
+}
+
+}  // namespace bench
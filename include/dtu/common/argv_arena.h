@@ -0,0 +1,87 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    argv_arena.h
+ * @brief   Declaration of ArgvArena
+ *          Holds a nullptr terminated argv table and all argument bytes
+ *          in a single allocation, the table points into the same block.
+ *          Copies rebase the table, moves only transfer the block, so
+ *          the char* pointers stay valid whatever the owner does.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_ARGV_ARENA_H_
+#define DTU_COMMON_ARGV_ARENA_H_
+
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+
+class ArgvArena {
+ public:
+  ArgvArena() = default;
+
+  /// Arguments from a range of std::string or const char*
+  template <typename Iterator>
+  ArgvArena(Iterator first, Iterator last) {
+    size_t count = 0, bytes = 0;
+    for (Iterator it = first; it != last; ++it, ++count) {
+      bytes += Length(*it) + 1;
+    }
+    Allocate(count, bytes);
+    for (Iterator it = first; it != last; ++it) {
+      Append(Data(*it), Length(*it));
+    }
+  }
+
+  /*!
+   * Executable cmd followed by the arguments in option, split on spaces
+   * only, as Subprocess(command, option) always did: quotes, backslashes,
+   * tabs and newlines are kept as they are, and a trailing space leaves
+   * an empty last argument.
+   */
+  static ArgvArena FromCommandLine(const std::string& cmd,
+                                   const std::string& option);
+
+  /*!
+   * Same, but option is split on blanks in a single pass with shell
+   * quoting. Single quotes keep everything literal, double quotes and
+   * backslashes work as in a POSIX shell, "" is an empty argument.
+   */
+  static ArgvArena FromShellWords(const std::string& cmd,
+                                  const std::string& option);
+
+  ArgvArena(const ArgvArena& other);
+  ArgvArena(ArgvArena&& other) noexcept;
+  ArgvArena& operator=(ArgvArena other) noexcept;
+
+  /// nullptr terminated table suitable for exec*() and posix_spawn()
+  char** data() const { return table(); }
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  const char* operator[](size_t index) const { return table()[index]; }
+
+ private:
+  static size_t Length(const std::string& arg) { return arg.size(); }
+  static size_t Length(const char* arg) { return strlen(arg); }
+  static const char* Data(const std::string& arg) { return arg.data(); }
+  static const char* Data(const char* arg) { return arg; }
+
+  /// Reserve room for up to count arguments of bytes in total
+  void Allocate(size_t max_count, size_t bytes);
+  void Append(const char* arg, size_t length);
+
+  char** table() const { return reinterpret_cast<char**>(block_.get()); }
+
+  std::unique_ptr<char[]> block_;
+  size_t block_size_ = 0;
+  size_t max_count_ = 0;
+  size_t count_ = 0;
+  size_t used_bytes_ = 0;
+};
+
+#endif  // DTU_COMMON_ARGV_ARENA_H_
@@ -0,0 +1,127 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    child_registry.h
+ * @brief   Declaration of ExitSlot and ChildRegistry
+ *          Process-wide reaper for children known by their pidfd. One
+ *          thread sleeps in epoll_wait() on the pidfds of every registered
+ *          child and reaps each with waitid(P_PIDFD), so only registered
+ *          children are reaped and a recycled pid can never be mistaken
+ *          for one of them. No SIGCHLD handler is involved: children
+ *          created by Subprocess::UseChildRegistry() do not even send it.
+ *          The exit status is published to waiters through one atomic
+ *          slot per child, woken with a futex.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_CHILD_REGISTRY_H_
+#define DTU_COMMON_CHILD_REGISTRY_H_
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "dtu/common/scoped_fd.h"
+
+/*!
+ * Exit status of one registered child. The reaper fills the fields once
+ * and then publishes them by storing the state, readers check Done() or
+ * block in Wait()/WaitUntil() and only read the fields afterwards.
+ * Done() is a single atomic load and so is safe in a signal handler.
+ */
+class ExitSlot {
+ public:
+  enum State {
+    kRunning,  ///< not reaped yet
+    kExited,   ///< reaped, wait_status() and usage() are valid
+    kLost      ///< could not be reaped, e.g. waited for elsewhere, error()
+  };
+
+  ExitSlot(const ExitSlot&) = delete;
+  ExitSlot& operator=(const ExitSlot&) = delete;
+
+  State state() const { return static_cast<State>(state_.load()); }
+  bool Done() const { return state() != kRunning; }
+
+  /// Block until the child was reaped
+  State Wait() const;
+
+  /// false if the deadline passed with the child still running
+  bool WaitUntil(std::chrono::steady_clock::time_point deadline) const;
+
+  pid_t pid() const { return pid_; }
+  /// pidfd of the child, open as long as the slot exists
+  int pidfd() const { return pidfd_.get(); }
+  /// waitpid() status word
+  int wait_status() const { return wait_status_; }
+  /// errno of waitid() for kLost
+  int error() const { return error_; }
+  const struct rusage& usage() const { return usage_; }
+  /// When the reaper found the pidfd readable
+  std::chrono::steady_clock::time_point exit_time() const {
+    return exit_time_;
+  }
+
+ private:
+  friend class ChildRegistry;
+
+  ExitSlot(pid_t pid, ScopedFD pidfd) : pid_(pid), pidfd_(std::move(pidfd)) {}
+
+  // futex word, written once by the reaper
+  mutable std::atomic<int> state_{kRunning};
+  // waiters sleeping on state_, the reaper skips FUTEX_WAKE without any
+  mutable std::atomic<int> waiters_{0};
+  pid_t pid_;
+  // closed with the last reference, never while a caller may signal it
+  ScopedFD pidfd_;
+  int wait_status_ = 0;
+  int error_ = 0;
+  struct rusage usage_ = {};
+  std::chrono::steady_clock::time_point exit_time_;
+};
+
+class ChildRegistry {
+ public:
+  static ChildRegistry& Instance();
+
+  /*!
+   * Reap the child behind *pidfd once it exits. The descriptor is moved
+   * into the returned slot, see ExitSlot::pidfd(), so no second one is
+   * opened per child. The child must not be waited for in any other way
+   * afterwards. Returns nullptr with errno set, and *pidfd untouched, if
+   * the reaper could not be started.
+   */
+  std::shared_ptr<const ExitSlot> Register(pid_t pid, ScopedFD* pidfd);
+
+  /// Registered children not reaped yet
+  size_t Pending() const { return pending_.load(); }
+
+ private:
+  ChildRegistry() = default;
+  ~ChildRegistry();
+
+  // create the epoll instance and reaper thread on first use, mutex_ held
+  bool StartLocked();
+  void ReapChildren();
+  void Reap(int pidfd);
+
+  std::mutex mutex_;
+  ScopedFD epoll_fd_;
+  ScopedFD stop_fd_;  // eventfd written by the destructor
+  std::thread thread_;
+  // registered children by their pidfd, guarded by mutex_
+  std::unordered_map<int, std::shared_ptr<ExitSlot>> children_;
+  std::atomic<size_t> pending_{0};
+};
+
+#endif  // DTU_COMMON_CHILD_REGISTRY_H_
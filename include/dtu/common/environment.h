@@ -0,0 +1,68 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    environment.h
+ * @brief   Declaration of Environment and EnvironmentBuilder
+ *          An Environment is the envp block handed to execve() and
+ *          posix_spawn(), built once into an ArgvArena and never changed
+ *          afterwards, so any number of Subprocess objects and threads
+ *          can share it without copying or locking.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_ENVIRONMENT_H_
+#define DTU_COMMON_ENVIRONMENT_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dtu/common/argv_arena.h"
+
+class Environment {
+ public:
+  /// nullptr terminated "NAME=value" table for execve() and posix_spawn()
+  char** envp() const { return entries_.data(); }
+  size_t size() const { return entries_.size(); }
+
+  /// Value of name, nullptr if it is not set
+  const char* Get(const std::string& name) const;
+
+ private:
+  friend class EnvironmentBuilder;
+  explicit Environment(ArgvArena entries) : entries_(std::move(entries)) {}
+
+  ArgvArena entries_;
+};
+
+/*!
+ * Collects the variables of an Environment. Names must not be empty nor
+ * contain '=', invalid ones are logged and ignored.
+ */
+class EnvironmentBuilder {
+ public:
+  /// Start without any variable
+  EnvironmentBuilder() = default;
+
+  /// Start from the environment of this process as it is now
+  static EnvironmentBuilder FromParent();
+
+  /// Add name or replace its value
+  EnvironmentBuilder& Set(const std::string& name, const std::string& value);
+  EnvironmentBuilder& Unset(const std::string& name);
+  EnvironmentBuilder& Clear();
+
+  /// Immutable block of the variables set so far, in the order added
+  std::shared_ptr<const Environment> Build() const;
+
+ private:
+  std::vector<std::string>::iterator Find(const std::string& name);
+
+  std::vector<std::string> entries_;  // "NAME=value"
+};
+
+#endif  // DTU_COMMON_ENVIRONMENT_H_
@@ -0,0 +1,91 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    executable_cache.h
+ * @brief   Declaration of ExecutableCache
+ *          Resolves a command name against PATH once in the parent, so
+ *          children exec the absolute path instead of trying every PATH
+ *          entry themselves. Entries are dropped when inotify reports a
+ *          change in a searched directory, directories that can not be
+ *          watched are checked by mtime on every lookup.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_EXECUTABLE_CACHE_H_
+#define DTU_COMMON_EXECUTABLE_CACHE_H_
+
+#include <time.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dtu/common/scoped_fd.h"
+
+class ExecutableCache {
+ public:
+  /// Process-wide cache used by Subprocess for commands without a '/'
+  static ExecutableCache& Instance();
+
+  /*!
+   * Absolute path of name found in search_path (a PATH value, nullptr
+   * for the default), or an empty string with *error set to ENOENT, or
+   * EACCES if only non-executable files were found. An empty string
+   * with *error 0 means a relative PATH entry was reached and the child
+   * has to search itself. Thread safe.
+   */
+  std::string Resolve(const char* name, const char* search_path,
+                      int* error);
+
+  /// When disabled Resolve() searches PATH on every call
+  void SetEnabled(bool enabled);
+  bool IsEnabled();
+
+  /// Drop every entry
+  void Clear();
+
+  /// PATH searches done so far
+  uint64_t SearchCount();
+
+  /// System calls made by lookups and searches so far, for benchmarks
+  uint64_t SyscallCount();
+
+ private:
+  // a searched directory inotify can not report on, checked by mtime
+  struct UnwatchedDir {
+    std::string dir;
+    bool exists;
+    struct timespec mtime;
+  };
+
+  struct Entry {
+    std::string path;  // empty if not found
+    int error;
+    bool cacheable;
+    std::vector<UnwatchedDir> unwatched;
+  };
+
+  ExecutableCache() = default;
+
+  Entry Search(const char* name, const char* search_path, bool watch);
+  bool Stat(const std::string& dir, struct timespec* mtime);
+  bool Watch(const std::string& dir);
+  void DrainEvents();
+  bool StillValid(const Entry& entry);
+
+  std::mutex mutex_;
+  bool enabled_ = true;
+  std::unordered_map<std::string, Entry> entries_;  // name '\0' PATH
+  ScopedFD inotify_fd_;
+  bool inotify_failed_ = false;
+  std::unordered_map<std::string, int> watched_dirs_;  // watch descriptor
+  uint64_t searches_ = 0;
+  uint64_t syscalls_ = 0;
+};
+
+#endif  // DTU_COMMON_EXECUTABLE_CACHE_H_
@@ -0,0 +1,56 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    pipeline.h
+ * @brief   Declaration of Pipeline
+ *          Connects N subprocesses stdout to stdin like a shell
+ *          pipeline, starts them together and collects every exit status
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_PIPELINE_H_
+#define DTU_COMMON_PIPELINE_H_
+
+#include <vector>
+
+#include "dtu/common/subprocess.h"
+
+class Pipeline {
+ public:
+  /*!
+   * Append a stage. The stage must not be started and must outlive the
+   * pipeline. stdin of the first stage and stdout of the last stage keep
+   * whatever redirection was set on them, everything else is a pipe.
+   */
+  Pipeline& Add(Subprocess& stage);
+
+  /// Capacity in bytes of the pipes between stages (F_SETPIPE_SZ)
+  void SetPipeCapacity(int bytes);
+
+  /*!
+   * Create the pipes and start every stage in order. If a stage can not
+   * be started, the ones after it are not started either, and the ones
+   * before it are killed and reaped. Returns false then, Wait() is not
+   * needed and returns -1 for every stage.
+   */
+  bool Start();
+
+  /// Wait for every stage, returns their SubprocessWait() values in order
+  std::vector<int> Wait();
+
+  /// Status of the rightmost failed stage or 0, like bash pipefail
+  int PipefailStatus() const;
+
+ private:
+  /// Kill and reap the first count stages
+  void StopStarted(size_t count);
+
+  std::vector<Subprocess*> stages_;
+  std::vector<int> statuses_;
+  int pipe_capacity_ = 0;
+};
+
+#endif  // DTU_COMMON_PIPELINE_H_
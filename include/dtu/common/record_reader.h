@@ -0,0 +1,86 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    record_reader.h
+ * @brief   Declaration of RecordReader
+ *          Splits a stream such as GetOutputFD() or GetErrorFD() into
+ *          delimiter separated records without copying them: records are
+ *          views into one reusable buffer, found with memchr(), which
+ *          glibc vectorizes. The reader only calls read() when the
+ *          consumer asks for a record that is not buffered yet, so a slow
+ *          consumer fills the pipe and the child blocks on its writes.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_RECORD_READER_H_
+#define DTU_COMMON_RECORD_READER_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+/// Record handed out by RecordReader, valid until its next Next() call
+struct RecordView {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  std::string ToString() const { return std::string(data, size); }
+#if __cplusplus >= 201703L
+  operator std::string_view() const { return std::string_view(data, size); }
+#endif
+};
+
+class RecordReader {
+ public:
+  enum Status {
+    kRecord,       ///< *record holds the next record
+    kEndOfStream,  ///< EOF and every record handed out
+    kWouldBlock,   ///< non-blocking fd without a complete record yet
+    kReadError     ///< read() failed, errno is set
+  };
+
+  /*!
+   * Read records ending with delimiter from fd, which stays owned by the
+   * caller. A record longer than capacity grows the buffer, which then
+   * keeps that size.
+   */
+  explicit RecordReader(int fd, char delimiter = '\n',
+                        size_t capacity = 65536);
+
+  RecordReader(const RecordReader&) = delete;
+  RecordReader& operator=(const RecordReader&) = delete;
+
+  /*!
+   * Next record without its delimiter. The last record is handed out at
+   * EOF even if the delimiter is missing.
+   */
+  Status Next(RecordView* record);
+
+  /// Records handed out so far
+  size_t Count() const { return count_; }
+
+ private:
+  // read more after making room, kRecord once data or EOF came in
+  Status Fill();
+
+  int fd_;
+  char delimiter_;
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  size_t begin_ = 0;    // first unread byte
+  size_t scanned_ = 0;  // bytes before this are known to hold no delimiter
+  size_t end_ = 0;      // one past the last buffered byte
+  bool eof_ = false;
+  size_t count_ = 0;
+};
+
+#endif  // DTU_COMMON_RECORD_READER_H_
@@ -0,0 +1,44 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    scoped_fd.h
+ * @brief   Declaration of ScopedFD
+ *          Move-only holder of a file descriptor that closes it when
+ *          it goes away, unless the descriptor was only borrowed from
+ *          the caller.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SCOPED_FD_H_
+#define DTU_COMMON_SCOPED_FD_H_
+
+class ScopedFD {
+ public:
+  ScopedFD() = default;
+  ~ScopedFD();
+
+  ScopedFD(ScopedFD&& other) noexcept;
+  ScopedFD& operator=(ScopedFD&& other) noexcept;
+
+  ScopedFD(const ScopedFD&) = delete;
+  ScopedFD& operator=(const ScopedFD&) = delete;
+
+  /// Take ownership of fd (-1 for none), closing the one held so far
+  void Reset(int fd = -1);
+
+  /// Refer to fd without owning it, it is never closed by us
+  void Borrow(int fd);
+
+  int get() const { return fd_; }
+  bool valid() const { return fd_ != -1; }
+  bool owned() const { return owned_; }
+
+ private:
+  int fd_ = -1;
+  bool owned_ = false;
+};
+
+#endif  // DTU_COMMON_SCOPED_FD_H_
@@ -0,0 +1,39 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    scoped_sigpipe_block.h
+ * @brief   Declaration of ScopedSigpipeBlock
+ *          Writing to a child that exits without reading its input must
+ *          not kill the caller with SIGPIPE, the write fails with EPIPE
+ *          instead while this is in scope.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SCOPED_SIGPIPE_BLOCK_H_
+#define DTU_COMMON_SCOPED_SIGPIPE_BLOCK_H_
+
+#include <signal.h>
+
+/*!
+ * Blocks SIGPIPE in the calling thread. On destruction a SIGPIPE raised
+ * meanwhile is discarded, unless one was already pending before, and the
+ * previous signal mask is restored.
+ */
+class ScopedSigpipeBlock {
+ public:
+  ScopedSigpipeBlock();
+  ~ScopedSigpipeBlock();
+
+  ScopedSigpipeBlock(const ScopedSigpipeBlock&) = delete;
+  ScopedSigpipeBlock& operator=(const ScopedSigpipeBlock&) = delete;
+
+ private:
+  sigset_t sigpipe_set_;
+  sigset_t old_set_;
+  bool was_pending_;
+};
+
+#endif  // DTU_COMMON_SCOPED_SIGPIPE_BLOCK_H_
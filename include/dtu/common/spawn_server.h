@@ -0,0 +1,69 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    spawn_server.h
+ * @brief   Declaration of SpawnServer
+ *          A small helper process forked early launches children on
+ *          behalf of a large parent, so launch cost does not depend on
+ *          the parent RSS, mapped libraries or thread count.
+ *          Requests travel over a Unix socket with the stdio fds and the
+ *          current directory attached as SCM_RIGHTS. Children are created with CLONE_PARENT, they are
+ *          children of the parent process and are waited for as usual.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SPAWN_SERVER_H_
+#define DTU_COMMON_SPAWN_SERVER_H_
+
+#include <sys/types.h>
+
+#include <mutex>
+
+class SpawnServer {
+ public:
+  /// Process-wide server used by the kSpawnServer launch backend
+  static SpawnServer& Instance();
+
+  /*!
+   * Fork the helper. Call early in main(), before threads are created
+   * and while the process is still small.
+   */
+  bool Start();
+
+  /// Ask the helper to exit and reap it
+  void Stop();
+
+  bool IsRunning();
+
+  /*!
+   * Launch file with argv and envp in the helper with stdio[0..2] as
+   * stdin, stdout and stderr. The environment and the current directory
+   * of the caller are sent with every request, so the child never sees
+   * the ones the helper was forked with. path selects execve() over
+   * execvpe(), which searches the PATH of envp and also runs a file
+   * without #! through /bin/sh. Returns the child pid and stores its
+   * pidfd in *pidfd, or returns -1 with errno set. If the child was
+   * created but its exec failed, that errno is also stored in
+   * *exec_error and the child is reaped. A lost reply is stored there
+   * too, the child may then exist and the command must not be launched
+   * again; the server is stopped. With *exec_error 0 nothing was
+   * launched, e.g. E2BIG for a request over 128 KiB.
+   */
+  pid_t Spawn(const char* file, char* const* argv, char* const* envp,
+              bool path, const int stdio[3], int* pidfd, int* exec_error);
+
+ private:
+  SpawnServer() = default;
+  ~SpawnServer();
+
+  static void ServeRequests(int socket_fd);
+
+  std::mutex mutex_;
+  int socket_fd_ = -1;
+  pid_t helper_pid_ = -1;
+};
+
+#endif  // DTU_COMMON_SPAWN_SERVER_H_
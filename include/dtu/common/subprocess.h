@@ -0,0 +1,568 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess.h
+ * @brief   Declaration of subprocess library
+ *          This library helps to create a child process and
+ *          executes the command provided by the user in the child process
+ *
+ * @author  CAI
+ * @date    2022-01-24
+ * @version V1.0
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_H_
+#define DTU_COMMON_SUBPROCESS_H_
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dtu/common/argv_arena.h"
+#include "dtu/common/environment.h"
+#include "dtu/common/scoped_fd.h"
+#include "dtu/util/switch_logging.h"
+
+#define FD_SIZE 2
+
+class ExitSlot;
+class TailCapture;
+
+/*!
+ * Mechanism used to create the child process.
+ * kPosixSpawn is the default; kVfork is kept for comparison only.
+ */
+enum LaunchBackend {
+  kPosixSpawn,  ///< posix_spawn()/posix_spawnp() with file actions
+  kClone3,      ///< clone(CLONE_VM | CLONE_VFORK | CLONE_PIDFD) on own stack
+  kVfork,       ///< legacy vfork() followed by exec in the child
+  kSpawnServer  ///< SpawnServer helper, falls back to kPosixSpawn
+};
+
+/// How the option string of Subprocess(command, option) is split
+enum OptionSyntax {
+  kSplitOnSpaces,  ///< on every space, nothing else is special (default)
+  kShellWords      ///< on blanks, with shell quotes and backslashes
+};
+
+/// Result of Subprocess::RunAndCapture()/CommunicateWithInput()
+struct CaptureResult {
+  int exit_status;     ///< value returned by SubprocessWait()
+  std::string output;  ///< everything the child wrote to stdout
+  std::string error;   ///< everything the child wrote to stderr
+};
+
+/// One command of Subprocess::SpawnBatch()
+struct CommandSpec {
+  std::vector<std::string> argv;  ///< argv[0] is the executable
+  std::string command;            ///< used with option if argv is empty
+  std::string option;
+  OptionSyntax syntax = kSplitOnSpaces;  ///< how option is split
+  std::string input_file;   ///< stdin read from this file if not empty
+  std::string output_file;  ///< stdout appended to this file if not empty
+  std::string error_file;   ///< stderr appended to this file if not empty
+  LaunchBackend backend = kPosixSpawn;
+  /// shared by every command given the same one, nullptr to inherit
+  std::shared_ptr<const Environment> environment;
+  std::string working_dir;  ///< working directory if not empty
+};
+
+/*!
+ * Result of Subprocess::WaitForExit(): how the child ended, what wait4()
+ * reported about its resource usage and how long each phase of its life
+ * took as measured by the library
+ */
+struct ExitInfo {
+  pid_t pid = -1;        ///< reaped child, -1 if nothing was reaped
+  int error = 0;         ///< errno when nothing was reaped
+  int wait_status = 0;   ///< as filled by wait4(), for WIFEXITED() etc.
+  int exit_code = -1;    ///< exit status, -1 if killed by a signal
+  int signal = 0;        ///< signal that killed the child, 0 if it exited
+  bool core_dumped = false;
+
+  std::chrono::microseconds user_time{0};
+  std::chrono::microseconds system_time{0};
+  /// also counts the memory shared with the parent until exec by vfork,
+  /// clone3 and posix_spawn, i.e. it is at least the parent RSS then
+  long max_rss_kb = 0;
+  long minor_faults = 0;
+  long major_faults = 0;
+  long voluntary_switches = 0;
+  long involuntary_switches = 0;
+
+  std::chrono::nanoseconds spawn_time{0};  ///< Start() until the launch
+  std::chrono::nanoseconds exec_time{0};   ///< launch until exec is done
+  std::chrono::nanoseconds run_time{0};    ///< exec until the exit is seen
+  std::chrono::nanoseconds reap_time{0};   ///< exit seen until reaped
+
+  bool timed_out = false;  ///< RunWithTimeout() deadline passed
+  bool killed = false;     ///< still running after the grace period
+};
+
+/// Process group or session of the child, see SetProcessGroup()
+enum ProcessGroupMode {
+  kInheritGroup,     ///< stays in the group of the parent
+  kNewProcessGroup,  ///< setpgid(0, 0), leads a new group
+  kNewSession        ///< setsid(), leads a new session without terminal
+};
+
+/// What Subprocess::RunWithTimeout() does once the deadline passes
+struct TimeoutPolicy {
+  int terminate_signal = SIGTERM;  ///< sent first, asking to exit
+  /// time left to exit before SIGKILL
+  std::chrono::nanoseconds grace_period = std::chrono::seconds(5);
+  /*!
+   * Signal the whole group the child leads, see SetProcessGroup(). A
+   * child RunWithTimeout() starts itself then gets a group of its own
+   * unless a mode was set, a child started before in the group of its
+   * parent is signalled alone.
+   */
+  bool signal_group = true;
+};
+
+/// I/O scheduling classes of Subprocess::SetIoPriority(), as ioprio_set()
+enum IoPriorityClass {
+  kIoPriorityRealtime = 1,
+  kIoPriorityBestEffort = 2,
+  kIoPriorityIdle = 3
+};
+
+/// Totals of the cgroup a child was placed in, see SetCgroup()
+struct CgroupUsage {
+  uint64_t memory_peak;  ///< bytes from memory.peak, 0 if not available
+  uint64_t cpu_usec;     ///< usage_usec from cpu.stat
+  uint64_t user_usec;    ///< user_usec from cpu.stat
+  uint64_t system_usec;  ///< system_usec from cpu.stat
+};
+
+/*!
+ * A Subprocess owns every descriptor it opens (files, pipes, /dev/null and
+ * the pidfd) and closes them when destroyed. Descriptors handed in as int
+ * or FILE* stay owned by the caller. Everything is opened close-on-exec
+ * and children start with nothing above stderr but InheritFD() ones, so
+ * no fd leaks into them. Objects can be moved but not copied.
+ *
+ * Thread safety: different objects can be set up, started and waited
+ * for from any number of threads at the same time. A pipe end of one
+ * never reaches a child started by another, so readers see EOF as soon
+ * as their own child is done. One object must not be used from two
+ * threads at once, except for the captures of SendOutputToTail() and
+ * SendErrorToTail().
+ */
+class Subprocess {
+ public:
+  /// Returned by SubprocessWaitForGivenTime()
+  enum ExitCodes {
+    kError = -1,     ///< non-zero exit code, or the wait failed
+    kSuccess,        ///< exit code 0
+    kInExecution,    ///< still running at the deadline
+    kStopped,        ///< terminated by a signal
+    kChildNotExist   ///< never started, or reaped already
+  };
+
+  /*!
+   * Create a Subprocess object and start execution immediately
+   * if start is set to true. option is split on spaces unless syntax
+   * asks for shell quoting, e.g. for "-c 'exit 3'".
+   */
+  Subprocess(std::string command, std::string option = "",
+             bool start = true, OptionSyntax syntax = kSplitOnSpaces);
+
+  /*!
+   * Create a Subprocess from an explicit argv, argv[0] being the
+   * executable. Arguments are taken as is, without splitting or quoting.
+   */
+  Subprocess(std::initializer_list<std::string> argv, bool start = true);
+
+  /// Same as above for a range of std::string or const char*
+  template <typename Iterator,
+            typename = typename std::enable_if<
+                !std::is_convertible<Iterator, std::string>::value>::type>
+  Subprocess(Iterator first, Iterator last, bool start = true)
+      : argv_(first, last) {
+    InitializeArgv();
+    if (start) CreateChildAndExecute();
+  }
+
+  /// Closes the owned descriptors, the child is neither waited for nor killed
+  ~Subprocess() = default;
+
+  Subprocess(Subprocess&& other) noexcept = default;
+  Subprocess& operator=(Subprocess&& other) noexcept = default;
+
+  Subprocess(const Subprocess&) = delete;
+  Subprocess& operator=(const Subprocess&) = delete;
+
+  /*!
+   * Start the process if start flag was false at construction time.
+   * Returns 0 once the child runs the command, otherwise the errno of
+   * the failed launch or exec (also kept by GetSpawnError()), e.g.
+   * ENOENT for a missing executable. A failed child is reaped already.
+   */
+  int Start();
+
+  /*!
+   * Start one subprocess per spec and return them in the same order.
+   * All argv arenas are built before the first launch, PATH is searched
+   * once per distinct executable and every output or error file is
+   * opened once for the whole batch. With threads > 1 the launches are
+   * spread over that many threads. A command that could not be started
+   * has GetPID() == -1 and keeps its own copy of its files, so Start()
+   * can be retried. A command whose output or error file could not be
+   * opened is not started, GetSpawnError() returns the errno of open(). Each launch costs what Start() costs, the batch only
+   * saves the setup around it.
+   */
+  static std::vector<Subprocess> SpawnBatch(
+      const std::vector<CommandSpec>& specs, int threads = 1);
+
+  /// Select how the child is created, must be called before Start()
+  void SetLaunchBackend(LaunchBackend backend);
+
+  /*!
+   * Resource settings applied by the child itself before exec, a failure
+   * is returned by Start(). They need the clone3 backend (vfork is kept
+   * if selected), which Start() then uses whatever was selected.
+   */
+  void SetResourceLimit(int resource, rlim_t soft_limit, rlim_t hard_limit);
+  void SetCpuAffinity(const cpu_set_t& cpus);
+  /// Nice value from -20 to 19, lowering it needs CAP_SYS_NICE
+  void SetNice(int nice);
+  /// level 0 (highest) to 7 for the realtime and best effort classes
+  void SetIoPriority(IoPriorityClass io_class, int level);
+
+  /*!
+   * Create the child directly in the cgroup v2 directory cgroup_dir with
+   * CLONE_INTO_CGROUP, so it never runs in the cgroup of the parent.
+   * Forces clone3, Start() fails if the kernel can not do it.
+   * Returns false if the directory can not be opened.
+   */
+  bool SetCgroup(const std::string& cgroup_dir);
+
+  /*!
+   * Run the child with environment instead of the environment of this
+   * process, nullptr to inherit it again. The block is shared, not
+   * copied. A command without '/' is searched in its PATH, or in the
+   * PATH of this process if it has none. Must be called before Start().
+   */
+  void SetEnvironment(std::shared_ptr<const Environment> environment);
+
+  /*!
+   * Run the child in directory, relative paths, including the one of
+   * the executable, then start from there. The dirfd overload borrows
+   * the descriptor until Start() returns.
+   */
+  void SetWorkingDirectory(const std::string& directory);
+  void SetWorkingDirectory(int dirfd);
+
+  /*!
+   * Let the child inherit fd under the same number. Otherwise it only
+   * gets stdin, stdout and stderr. fd stays owned by the caller and must
+   * stay open until Start() returns. Like the resource settings this
+   * needs the clone3 backend, which Start() then uses.
+   */
+  void InheritFD(int fd);
+
+  /*!
+   * Create the child in a process group or session of its own, so
+   * SubprocessKill() and RunWithTimeout() reach the processes it starts
+   * as well. Must be called before Start().
+   */
+  void SetProcessGroup(ProcessGroupMode mode);
+
+  /*!
+   * Leave reaping to the process-wide ChildRegistry. The child is created
+   * by the kClone3 backend without exit signal, so no SIGCHLD is raised
+   * for it and waitpid(-1) elsewhere in the process can not reap it; the
+   * wait calls of this object then read its exit from the registry. Its
+   * pidfd is handed over to the registry, GetPidFD() stays valid while
+   * this object lives. Wait for it only through this object, GetPID()
+   * and GetPidFD() are for signals and polling. Must be called before
+   * Start().
+   */
+  void UseChildRegistry();
+  bool UsesChildRegistry() const { return use_registry_; }
+
+  /*!
+   * Peak memory and CPU time of the cgroup given to SetCgroup(), read
+   * after SubprocessWait(). They cover every process ever in the cgroup,
+   * so give each child its own for per-child numbers.
+   */
+  bool GetCgroupUsage(CgroupUsage* usage);
+
+  /*!
+   * Wait for subprocess to complete its execution. Returns the exit code,
+   * or the signal number if killed, see WaitForExit() to tell them apart
+   */
+  int SubprocessWait();
+
+  /*!
+   * Wait for the child and reap it with wait4(), keeping its exit code
+   * or signal apart, its resource usage and the phase timings. Nothing
+   * is logged. The run phase ends when the exit is seen, i.e. when this
+   * is called if the child exited before. Without a pidfd the exit is
+   * only seen once reaped and reap_time is 0.
+   */
+  ExitInfo WaitForExit();
+
+  /// Wait for subprocess for a given time duration in seconds
+  int SubprocessWaitForGivenTime(int time_duration);
+
+  /*!
+   * Wait for subprocess for a given std::chrono duration.
+   * Blocks on the child pidfd until exit or deadline, so the exit is
+   * seen immediately and nothing wakes up while the child is running.
+   */
+  int SubprocessWaitForGivenTime(std::chrono::nanoseconds time_duration);
+
+  /*!
+   * Start the subprocess unless it was started, then wait for its exit
+   * until timeout. Past the deadline policy.terminate_signal is sent and
+   * SIGKILL follows once the grace period is over too. With a process
+   * group of its own, which policy.signal_group creates when this
+   * starts the child, both go to the whole group, and the SIGKILL is sent
+   * even if the child exited in time, so no descendant ignoring the
+   * first signal survives. The child is reaped as by WaitForExit().
+   */
+  ExitInfo RunWithTimeout(std::chrono::nanoseconds timeout,
+                          TimeoutPolicy policy = TimeoutPolicy());
+
+  /// Kill the subprocess, or its whole process group if it leads one
+  int SubprocessKill();
+
+  // Input Channel
+  void ReceiveInputFromFile(std::string filename);
+  void ReceiveInputFromFile(FILE* fp);
+  void ReceiveInputFromFile(int fd);
+  /// Connect stdin to a pipe, its write end is returned by GetInputFD()
+  void ReceiveInputFromPipe();
+  /// Close the write end of the input pipe, the child then reads EOF
+  void CloseInput();
+
+  // Output Channel
+  /// Append to filename, GetOutputFD() later opens it for reading
+  void SendOutputToFile(std::string filename);
+  void SendOutputToFile(FILE* fp);
+  void SendOutputToFile(int fd);
+  /// Connect stdout to a pipe, its read end is returned by GetOutputFD()
+  void SendOutputToPipe();
+
+  // Error Channel
+  /// Append to filename, GetErrorFD() later opens it for reading
+  void SendErrorToFile(std::string filename);
+  void SendErrorToFile(FILE* fp);
+  void SendErrorToFile(int fd);
+  /// Connect stderr to a pipe, its read end is returned by GetErrorFD()
+  void SendErrorToPipe();
+
+  /*!
+   * Keep only the last capacity bytes of stdout or stderr: the pipe is
+   * drained into the ring of a TailCapture, returned by GetOutputTail()
+   * or GetErrorTail(), from its own thread, so memory stays the same
+   * however long the child runs. GetOutputFD()/GetErrorFD() return -1.
+   */
+  void SendOutputToTail(size_t capacity);
+  void SendErrorToTail(size_t capacity);
+
+  /// Captures of SendOutputToTail()/SendErrorToTail(), nullptr otherwise
+  std::shared_ptr<TailCapture> GetOutputTail();
+  std::shared_ptr<TailCapture> GetErrorTail();
+
+  /*!
+   * Descriptors stay owned by the Subprocess, close them with CloseInput()
+   * or by destroying it. The child ends are closed by Start().
+   */
+  int GetInputFD();
+  int GetOutputFD();
+  int GetErrorFD();
+
+  /*!
+   * 0, or the errno value of the last failed launch: ENOENT or EACCES
+   * when the executable is not found in PATH, which is detected before
+   * any child is created, otherwise the error of creating the child or
+   * of its exec
+   */
+  int GetSpawnError();
+
+  /// Child pid, -1 until the child is created
+  pid_t GetPID();
+  /// Child pidfd, -1 if the kernel does not support pidfds
+  int GetPidFD();
+  /// When the last Start() saw the child exec'd, for kTraceExit
+  std::chrono::steady_clock::time_point GetExecTime() const {
+    return exec_time_;
+  }
+
+  /*!
+   * Communicate output of this subprocess as input of receiver.
+   * Both are started and waited for, returns the status of the failed
+   * one (receiver first) or 0, see Pipeline for longer chains.
+   */
+  int Communicate(Subprocess& receiver);
+
+  /*!
+   * Start the subprocess with pipes on all three streams, feed it
+   * input and collect stdout/stderr in memory until it exits.
+   * The streams are pumped together with poll(), so a child filling one
+   * pipe while we write or read another can not deadlock.
+   * The subprocess must not be started yet.
+   */
+  CaptureResult CommunicateWithInput(const std::string& input);
+  CaptureResult CommunicateWithInput(const char* input, size_t input_size);
+
+  /// CommunicateWithInput() with an empty stdin
+  CaptureResult RunAndCapture();
+
+ private:
+  void InitializeCommand(std::string cmd, std::string option,
+                         OptionSyntax syntax);
+  void InitializeArgv();
+  void CreateChildAndExecute();
+
+  /// Body of CreateChildAndExecute() between the trace events
+  pid_t LaunchChild();
+
+  /*!
+   * Launch backends, each returns the child pid or -1 on failure.
+   * The vfork/clone3 children only run ExecuteProcess().
+   */
+  pid_t SpawnWithPosixSpawn();
+  pid_t SpawnWithClone3();
+  /// clone3(CLONE_INTO_CGROUP) of kClone3 for SetCgroup()
+  pid_t SpawnIntoCgroup();
+  pid_t SpawnWithVfork();
+  pid_t SpawnWithServer();
+
+  /// Child side of vfork/clone3, only async-signal-safe calls
+  void ExecuteProcess(int status_fd);
+
+  /// Apply resources_ in the vfork/clone3 child, false with errno set
+  bool ApplyResourcesInChild();
+
+  /// Change to the working directory in the vfork/clone3 child
+  bool ChangeDirectoryInChild();
+
+  /// envp of the child, environ unless SetEnvironment() was called
+  char** ChildEnvironment() const;
+
+  /*!
+   * Parent side of the exec status pipe of vfork/clone3. Returns false,
+   * with the child reaped and spawn_error_ set, if its exec failed.
+   */
+  bool ExecSucceeded(pid_t pid, ScopedFD* status);
+
+  void CloseChildFDsInParent();
+
+  /// pidfd of the child, opened after spawn unless clone3 provided one
+  void OpenPidFD();
+  void ClosePidFD();
+
+  /// Returns true if the child pidfd became readable before deadline
+  bool PollPidFD(std::chrono::steady_clock::time_point deadline);
+
+  /// Returns true once the child exited before deadline, without reaping
+  bool WaitUntil(std::chrono::steady_clock::time_point deadline);
+
+  /*!
+   * Signal the child, or its process group if group and it leads one.
+   * Fails with ESRCH once the child was reaped, as its pid or group id
+   * may have been reused.
+   */
+  int SignalChild(int signal_number, bool group);
+
+  /// Non-blocking reap, returns kInExecution while the child runs
+  int ReapIfExited();
+
+  /*!
+   * Reap the child like wait4(), from its ExitSlot if it was registered.
+   * Returns 0 for WNOHANG while it runs, -1 with errno set, ECHILD once
+   * reaped, so a recycled pid is never waited for.
+   */
+  pid_t ReapChild(int options, int* wait_status, struct rusage* usage);
+
+  /// Write input and drain stdout/stderr pipes until all are closed
+  void PumpStreams(const char* input, size_t input_size,
+                   std::string* output, std::string* error);
+
+  /// Path exec*() is given, resolved_path_ if set, otherwise argv[0]
+  const char* ExecutablePath() const;
+
+  /// Look argv[0] up in ExecutableCache, false with spawn_error_ set
+  bool ResolveExecutable();
+
+  /// argv table and bytes in one block, safe to copy and move
+  ArgvArena argv_;
+  bool path_ = false;
+  // absolute path of argv[0] once it has been searched in PATH
+  std::string resolved_path_;
+  int spawn_error_ = 0;
+  pid_t child_pid_ = -1;
+  ScopedFD pidfd_;
+  LaunchBackend backend_ = kPosixSpawn;
+  ProcessGroupMode group_mode_ = kInheritGroup;
+  std::shared_ptr<const Environment> environment_;
+  // working directory, as a path or a borrowed descriptor
+  std::string working_dir_;
+  int working_dir_fd_ = -1;
+  bool use_registry_ = false;
+  // set by Start() under UseChildRegistry(), filled by the reaper thread
+  std::shared_ptr<const ExitSlot> exit_slot_;
+  bool reaped_ = false;
+
+  // phase boundaries of the last Start(), see ExitInfo
+  std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::time_point launch_time_;
+  std::chrono::steady_clock::time_point exec_time_;
+
+  // InheritFD() descriptors in ascending order
+  std::vector<int> inherited_fds_;
+
+  // settings ExecuteProcess() applies before exec
+  struct ChildResources {
+    std::vector<std::pair<int, struct rlimit>> limits;
+    bool set_affinity = false;
+    cpu_set_t affinity;
+    bool set_nice = false;
+    int nice = 0;
+    int io_priority = -1;
+    ScopedFD cgroup_fd;
+
+    bool empty() const {
+      return limits.empty() && !set_affinity && !set_nice &&
+             io_priority == -1 && !cgroup_fd.valid();
+    }
+  };
+  ChildResources resources_;
+
+  ScopedFD input_fd_[FD_SIZE];
+  ScopedFD output_fd_[FD_SIZE];
+  ScopedFD error_fd_[FD_SIZE];
+
+  // files behind SendOutputToFile()/SendErrorToFile(), opened for reading
+  // only when GetOutputFD()/GetErrorFD() asks for them
+  std::string output_path_;
+  std::string error_path_;
+
+  // read ends of SendOutputToTail()/SendErrorToTail(), drained by these
+  std::shared_ptr<TailCapture> output_tail_;
+  std::shared_ptr<TailCapture> error_tail_;
+};
+
+#endif  // DTU_COMMON_SUBPROCESS_H_
@@ -0,0 +1,157 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_async.h
+ * @brief   C++20 coroutine awaitables on top of SubprocessReactor
+ *          A coroutine can co_await the exit of a subprocess and the data
+ *          on its output pipes, while a single thread running the reactor
+ *          drives every in-flight subprocess. Header only, and empty
+ *          unless the translation unit is built with coroutine support.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_ASYNC_H_
+#define DTU_COMMON_SUBPROCESS_ASYNC_H_
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+
+#include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_reactor.h"
+
+/// Result of AsyncStream::ReadSome(), co_await yields the read() result
+class ReadAwaitable {
+ public:
+  ReadAwaitable(int fd, SubprocessReactor* reactor, char* buffer,
+                size_t size)
+      : fd_(fd), reactor_(reactor), buffer_(buffer), size_(size) {}
+
+  // data, EOF or a hard error is returned without suspending
+  bool await_ready() { return TryRead(); }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    return Arm();
+  }
+
+  /// Bytes read, 0 on EOF, -1 with errno set on error
+  ssize_t await_resume() { return result_; }
+
+ private:
+  bool TryRead() {
+    do {
+      result_ = read(fd_, buffer_, size_);
+    } while (result_ == -1 && errno == EINTR);
+    return result_ != -1 || errno != EAGAIN;
+  }
+
+  // returns false, resuming at once, if the fd can not be watched
+  bool Arm() {
+    return reactor_->WatchReady(fd_, EPOLLIN, [this](int, uint32_t) {
+      if (!TryRead() && Arm()) return;
+      handle_.resume();
+    });
+  }
+
+  int fd_;
+  SubprocessReactor* reactor_;
+  char* buffer_;
+  size_t size_;
+  ssize_t result_ = -1;
+  std::coroutine_handle<> handle_;
+};
+
+/// Awaitable pipe end of a subprocess, see AsyncSubprocess::Stdout()
+class AsyncStream {
+ public:
+  /// Switches fd to non-blocking mode
+  AsyncStream(int fd, SubprocessReactor* reactor)
+      : fd_(fd), reactor_(reactor) {
+    int flags = fcntl(fd_, F_GETFL);
+    if (flags != -1) fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  /// co_await to read up to size bytes once any are available
+  ReadAwaitable ReadSome(char* buffer, size_t size) {
+    return ReadAwaitable(fd_, reactor_, buffer, size);
+  }
+
+  template <size_t N>
+  ReadAwaitable ReadSome(char (&buffer)[N]) {
+    return ReadAwaitable(fd_, reactor_, buffer, N);
+  }
+
+ private:
+  int fd_;
+  SubprocessReactor* reactor_;
+};
+
+/*!
+ * Coroutine view of a started Subprocess. Both objects must outlive every
+ * co_await on it, and the reactor must be run, e.g. with Run(), by the
+ * thread that resumes the coroutines.
+ */
+class AsyncSubprocess {
+ public:
+  class ExitAwaitable {
+   public:
+    explicit ExitAwaitable(AsyncSubprocess* async) : async_(async) {}
+
+    // without a pidfd fall back to a blocking SubprocessWait()
+    bool await_ready() { return async_->process_->GetPidFD() == -1; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return async_->reactor_->WatchReady(
+          async_->process_->GetPidFD(), EPOLLIN,
+          [handle](int, uint32_t) { handle.resume(); });
+    }
+
+    /// Same value as SubprocessWait(), the child has exited by now
+    int await_resume() { return async_->process_->SubprocessWait(); }
+
+   private:
+    AsyncSubprocess* async_;
+  };
+
+  AsyncSubprocess(Subprocess& process, SubprocessReactor& reactor)
+      : process_(&process), reactor_(&reactor) {}
+
+  /// co_await until the child exits, then reap it
+  ExitAwaitable Exited() { return ExitAwaitable(this); }
+
+  /// Read end of the output pipe, needs SendOutputToPipe()
+  AsyncStream Stdout() {
+    return AsyncStream(process_->GetOutputFD(), reactor_);
+  }
+
+  /// Read end of the error pipe, needs SendErrorToPipe()
+  AsyncStream Stderr() {
+    return AsyncStream(process_->GetErrorFD(), reactor_);
+  }
+
+ private:
+  Subprocess* process_;
+  SubprocessReactor* reactor_;
+};
+
+/// Minimal fire-and-forget coroutine type for callers without their own
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return DetachedTask(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+#endif  // __has_include(<coroutine>)
+#endif  // __cpp_impl_coroutine
+
+#endif  // DTU_COMMON_SUBPROCESS_ASYNC_H_
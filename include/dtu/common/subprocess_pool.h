@@ -0,0 +1,112 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_pool.h
+ * @brief   Declaration of SubprocessPool
+ *          Keeps warm, long-lived worker subprocesses and dispatches
+ *          small jobs to them over their stdin/stdout pipes, so repeated
+ *          calls of the same tool do not pay exec and dynamic linking
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_POOL_H_
+#define DTU_COMMON_SUBPROCESS_POOL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dtu/common/subprocess.h"
+
+/// Framing of jobs and responses on the worker pipes
+enum PoolProtocol {
+  kNewlineDelimited,  ///< one line per job and per response
+  kLengthPrefixed     ///< 4 byte big-endian length, then the payload
+};
+
+struct PoolOptions {
+  int workers = 4;
+  PoolProtocol protocol = kNewlineDelimited;
+  int max_jobs_per_worker = 0;  ///< respawn after this many jobs, 0 = never
+  size_t max_rss_bytes = 0;     ///< respawn above this RSS, 0 = never
+  /// time a retired worker gets to exit on stdin EOF before SIGKILL
+  std::chrono::nanoseconds stop_timeout = std::chrono::seconds(5);
+};
+
+struct PoolStats {
+  size_t queue_depth;       ///< callers waiting for an idle worker
+  uint64_t jobs;            ///< completed jobs
+  uint64_t failed_jobs;     ///< jobs lost to a crashed worker
+  uint64_t respawns;        ///< workers replaced
+  uint64_t start_failures;  ///< workers that could not be started
+  double mean_latency_us;   ///< per job, including queueing
+  double max_latency_us;
+};
+
+class SubprocessPool {
+ public:
+  /// Start options.workers instances of command with the given option
+  SubprocessPool(std::string command, std::string option,
+                 PoolOptions options = PoolOptions());
+
+  /// Closes the worker pipes and reaps the workers, no Run() may be active
+  ~SubprocessPool();
+
+  SubprocessPool(const SubprocessPool&) = delete;
+  SubprocessPool& operator=(const SubprocessPool&) = delete;
+
+  /*!
+   * Send one job to an idle worker and wait for its response.
+   * Thread safe, callers queue while every worker is busy. Returns false
+   * if the worker died during the job, it is killed and respawned for the
+   * next one. A worker that could not be started is started again first.
+   */
+  bool Run(const std::string& job, std::string* response);
+
+  /// Callers currently waiting for an idle worker
+  size_t QueueDepth();
+
+  PoolStats Stats();
+
+ private:
+  struct Worker {
+    std::unique_ptr<Subprocess> process;
+    int jobs;
+    std::string buffered;  // bytes read past the previous response
+  };
+
+  /// false if the worker could not be started, it has no pid then
+  bool StartWorker(Worker* worker);
+  /// SIGKILL a failed worker, give a retired one stop_timeout to exit
+  void StopWorker(Worker* worker, bool failed);
+  bool NeedsRespawn(Worker* worker);
+  bool WriteJob(Worker* worker, const std::string& job);
+  bool ReadResponse(Worker* worker, std::string* response);
+  bool ReadMore(Worker* worker);
+
+  std::string command_;
+  std::string option_;
+  PoolOptions options_;
+
+  std::mutex mutex_;
+  std::condition_variable idle_cv_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<Worker*> idle_;
+  size_t waiting_ = 0;
+
+  uint64_t jobs_ = 0;
+  uint64_t failed_jobs_ = 0;
+  uint64_t respawns_ = 0;
+  uint64_t start_failures_ = 0;
+  double total_latency_us_ = 0;
+  double max_latency_us_ = 0;
+};
+
+#endif  // DTU_COMMON_SUBPROCESS_POOL_H_
@@ -0,0 +1,115 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_reactor.h
+ * @brief   Declaration of SubprocessReactor
+ *          Supervises many subprocesses from a single thread: children
+ *          are watched through their pidfds and reaped as they exit,
+ *          and their output pipes are multiplexed in the same epoll set
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_REACTOR_H_
+#define DTU_COMMON_SUBPROCESS_REACTOR_H_
+
+#include <sys/epoll.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "dtu/common/subprocess.h"
+
+class SubprocessReactor {
+ public:
+  /*!
+   * Called once the child is reaped, status as filled by waitpid(), or
+   * kExitLost if it could not be reaped, e.g. it was reaped elsewhere
+   */
+  typedef std::function<void(pid_t pid, int wait_status)> ExitCallback;
+
+  /// Called for every chunk read from an output fd, size 0 means EOF
+  typedef std::function<void(int fd, const char* data, size_t size)>
+      OutputCallback;
+
+  /// Called once fd is ready, events as reported by epoll
+  typedef std::function<void(int fd, uint32_t events)> ReadyCallback;
+
+  /// wait_status of an ExitCallback for a child that could not be reaped
+  static const int kExitLost = -1;
+
+  SubprocessReactor();
+  ~SubprocessReactor();
+
+  SubprocessReactor(const SubprocessReactor&) = delete;
+  SubprocessReactor& operator=(const SubprocessReactor&) = delete;
+
+  /*!
+   * Watch a started subprocess. The reactor reaps the child itself, so
+   * SubprocessWait() must not be called on it afterwards. Returns false
+   * if the child has no pidfd or is reaped by the ChildRegistry.
+   */
+  bool Watch(Subprocess& process, ExitCallback on_exit);
+
+  /*!
+   * Watch the read end of a pipe, e.g. GetOutputFD() after
+   * SendOutputToPipe(). The fd is switched to non-blocking mode and is
+   * dropped from the reactor, but not closed, on EOF.
+   */
+  bool WatchOutput(int fd, OutputCallback on_output);
+
+  /*!
+   * Call on_ready once fd is ready for events (EPOLLIN, EPOLLOUT), then
+   * stop watching it. Nothing is read, reaped or closed, so this is the
+   * building block for awaitables and other executors. The callback may
+   * watch the fd again. An fd can only be watched once at a time.
+   */
+  bool WatchReady(int fd, uint32_t events, ReadyCallback on_ready);
+
+  /*!
+   * Wait up to timeout_ms (-1 for ever) for events and dispatch them.
+   * Returns the number of events handled or -1 on error.
+   */
+  int RunOnce(int timeout_ms);
+
+  /// Dispatch events until nothing is watched anymore
+  void Run();
+
+  /// Number of children and output fds still watched
+  size_t Pending() const;
+
+  /// System calls made while dispatching so far, for benchmarks
+  uint64_t SyscallCount() const;
+
+  /*!
+   * Reap the child behind pidfd with waitid(P_PIDFD) and __WALL, so
+   * children without exit signal are found too. Returns its pid, 0 while
+   * it runs or -1 with errno set, *wait_status as filled by waitpid().
+   */
+  static pid_t ReapPidFD(int pidfd, int* wait_status);
+
+ private:
+  struct Entry {
+    pid_t pid;  // -1 for output and readiness fds
+    std::chrono::steady_clock::time_point exec_time;  // of the child
+    ExitCallback on_exit;
+    OutputCallback on_output;
+    ReadyCallback on_ready;
+  };
+
+  bool Add(int fd, uint32_t events, Entry entry);
+  void Remove(int fd);
+  void HandleExit(int fd, const Entry& entry);
+  void HandleOutput(int fd, const Entry& entry);
+  void HandleReady(int fd, uint32_t events, const Entry& entry);
+
+  int epoll_fd_;
+  uint64_t syscalls_ = 0;
+  std::unordered_map<int, Entry> entries_;  // keyed by watched fd
+};
+
+#endif  // DTU_COMMON_SUBPROCESS_REACTOR_H_
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_splice.h
+ * @brief   Zero-copy data paths between files, pipes and subprocesses
+ *          Data is moved inside the kernel with splice(), tee() and
+ *          vmsplice(), falling back to read()/write() when the kernel or
+ *          the file type does not support it.
+ *          All functions expect blocking fds and return the number of
+ *          bytes moved or -1 on error.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_SPLICE_H_
+#define DTU_COMMON_SUBPROCESS_SPLICE_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/*!
+ * Move up to length bytes, until EOF by default, from in_fd to out_fd,
+ * e.g. from a file into GetInputFD() after ReceiveInputFromPipe() or
+ * from GetOutputFD() after SendOutputToPipe() into a file or socket.
+ * When neither fd is a pipe the data goes through a private pipe.
+ */
+ssize_t SpliceStream(int in_fd, int out_fd, size_t length = SIZE_MAX);
+
+/*!
+ * Fan out everything readable from in_pipe until EOF: a copy is
+ * duplicated into out_pipe with tee() and the data is then spliced to
+ * out_fd, e.g. one stdout feeding a downstream stage and a log file.
+ */
+ssize_t TeeStream(int in_pipe, int out_pipe, int out_fd);
+
+/*!
+ * Write data into out_pipe by mapping the user pages with vmsplice().
+ * The buffer must stay unchanged until the reader has consumed it.
+ */
+ssize_t VmspliceBuffer(int out_pipe, const char* data, size_t size);
+
+#endif  // DTU_COMMON_SUBPROCESS_SPLICE_H_
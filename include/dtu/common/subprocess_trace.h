@@ -0,0 +1,170 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_trace.h
+ * @brief   Declaration of the subprocess lifecycle instrumentation
+ *          An observer installed with SubprocessTrace::SetObserver() is
+ *          told about spawn, exec, output, exit and reap of every child.
+ *          SubprocessMetrics keeps lock-free counters and histograms,
+ *          ChromeTraceWriter writes a Chrome trace / Perfetto JSON file.
+ *          Without an observer each hook is one predicted branch, with
+ *          SUBPROCESS_DISABLE_TRACE defined it compiles to nothing.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_TRACE_H_
+#define DTU_COMMON_SUBPROCESS_TRACE_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+/// Lifecycle events, value of TraceRecord as noted
+enum TraceEvent {
+  kTraceSpawnStart,   ///< Start() entered, pid -1, value 0
+  kTraceExec,         ///< child exec'd, value ns since kTraceSpawnStart
+  kTraceSpawnEnd,     ///< Start() returns, value its errno (0 on success)
+  kTraceFirstOutput,  ///< first byte read on stream, value ns since exec
+  kTraceStreamBytes,  ///< stream done, value bytes moved through it
+  kTraceExit,         ///< exit seen, value ns since exec
+  kTraceReap          ///< child reaped, value the wait status
+};
+
+struct TraceRecord {
+  TraceEvent event;
+  pid_t pid;
+  int stream;  ///< STDIN/STDOUT/STDERR_FILENO for stream events, else -1
+  int64_t value;
+  std::chrono::steady_clock::time_point time;
+};
+
+/*!
+ * Receives the events of every Subprocess, from the thread driving the
+ * child (Start(), the waits, the reactors), never from a child. Must be
+ * thread safe.
+ */
+class SubprocessObserver {
+ public:
+  virtual ~SubprocessObserver() = default;
+  virtual void OnEvent(const TraceRecord& record) = 0;
+};
+
+class SubprocessTrace {
+ public:
+  /*!
+   * Install observer (nullptr to stop), returns the previous one. It must
+   * stay alive until replaced and no child started before is in flight.
+   */
+  static SubprocessObserver* SetObserver(SubprocessObserver* observer);
+
+  /// Cheap check done by every hook before building a record
+  static bool Enabled() {
+#ifdef SUBPROCESS_DISABLE_TRACE
+    return false;
+#else
+    return __builtin_expect(
+        observer_.load(std::memory_order_relaxed) != nullptr, 0);
+#endif
+  }
+
+  /// ns from begin to end, the unit of the duration values above
+  static int64_t Nanoseconds(std::chrono::steady_clock::time_point begin,
+                             std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+        .count();
+  }
+
+  /// Hand a record to the observer, call only if Enabled()
+  static void Emit(TraceEvent event, pid_t pid, int stream, int64_t value,
+                   std::chrono::steady_clock::time_point time =
+                       std::chrono::steady_clock::now());
+
+ private:
+  static std::atomic<SubprocessObserver*> observer_;
+};
+
+/// Power of two buckets of relaxed atomic counters, lock-free
+class TraceHistogram {
+ public:
+  static const int kBuckets = 64;
+
+  void Record(uint64_t value);
+  uint64_t Count() const;
+  uint64_t Sum() const;
+  /// Upper bound of the bucket holding the given fraction (0.5, 0.99)
+  uint64_t Percentile(double fraction) const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+};
+
+/// Counters and histograms over every traced child
+class SubprocessMetrics : public SubprocessObserver {
+ public:
+  void OnEvent(const TraceRecord& record) override;
+
+  uint64_t Spawns() const { return spawns_.load(std::memory_order_relaxed); }
+  uint64_t SpawnFailures() const {
+    return spawn_failures_.load(std::memory_order_relaxed);
+  }
+  uint64_t Reaped() const { return reaped_.load(std::memory_order_relaxed); }
+
+  const TraceHistogram& SpawnLatency() const { return spawn_latency_; }
+  const TraceHistogram& FirstOutputLatency() const {
+    return first_output_latency_;
+  }
+  const TraceHistogram& Lifetime() const { return lifetime_; }
+  /// Bytes per child and stream, indexed by STDIN/STDOUT/STDERR_FILENO
+  const TraceHistogram& StreamBytes(int stream) const {
+    return stream_bytes_[stream];
+  }
+
+  /// One line per metric, for logs
+  std::string Summary() const;
+
+ private:
+  std::atomic<uint64_t> spawns_{0};
+  std::atomic<uint64_t> spawn_failures_{0};
+  std::atomic<uint64_t> reaped_{0};
+  TraceHistogram spawn_latency_;         // ns
+  TraceHistogram first_output_latency_;  // ns
+  TraceHistogram lifetime_;              // ns
+  TraceHistogram stream_bytes_[3];
+};
+
+/*!
+ * Writes the events as Chrome trace JSON, loadable in chrome://tracing
+ * and ui.perfetto.dev: Start() as a span on the calling thread, each
+ * child's run from exec to exit as an async span and the rest as
+ * instant events. The file is complete once Close() or the destructor
+ * has run.
+ */
+class ChromeTraceWriter : public SubprocessObserver {
+ public:
+  explicit ChromeTraceWriter(const std::string& filename);
+  ~ChromeTraceWriter() override;
+
+  ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+  ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+  bool IsOpen() const { return fp_ != nullptr; }
+  void OnEvent(const TraceRecord& record) override;
+  void Close();
+
+ private:
+  std::mutex mutex_;
+  FILE* fp_;
+  bool first_ = true;
+};
+
+#endif  // DTU_COMMON_SUBPROCESS_TRACE_H_
@@ -0,0 +1,177 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_uring.h
+ * @brief   Declaration of SubprocessUring
+ *          io_uring engine for the stdio pipes and the exit of many
+ *          children: output is read into a provided buffer ring, writes
+ *          to stdin are batched into one submission and children are
+ *          reaped with IORING_OP_WAITID where the kernel has it.
+ *          Falls back to SubprocessReactor (epoll) when io_uring is
+ *          missing or disabled.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_SUBPROCESS_URING_H_
+#define DTU_COMMON_SUBPROCESS_URING_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_reactor.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+struct UringOptions {
+  unsigned queue_depth = 4096;   ///< submission queue entries
+  unsigned buffer_count = 64;    ///< provided read buffers, power of 2
+  unsigned buffer_size = 65536;  ///< bytes per read buffer, a pipe full
+};
+
+/*!
+ * Same model as SubprocessReactor: one thread adds watches and runs the
+ * engine, callbacks run on that thread. The ring is created with
+ * IORING_SETUP_SINGLE_ISSUER, so it must be driven by the thread that
+ * constructed it.
+ */
+class SubprocessUring {
+ public:
+  typedef SubprocessReactor::ExitCallback ExitCallback;
+  typedef SubprocessReactor::OutputCallback OutputCallback;
+
+  /// Called with the number of bytes written once all are, -1 on error
+  typedef std::function<void(int fd, ssize_t result)> WriteCallback;
+
+  explicit SubprocessUring(UringOptions options = UringOptions());
+  ~SubprocessUring();
+
+  SubprocessUring(const SubprocessUring&) = delete;
+  SubprocessUring& operator=(const SubprocessUring&) = delete;
+
+  /// False when io_uring is unavailable and epoll is used instead
+  bool UsesUring() const;
+
+  /// True when children are reaped by IORING_OP_WAITID (Linux 6.7+)
+  bool UsesWaitid() const;
+
+  /*!
+   * Reap a started subprocess once it exits, SubprocessWait() must not
+   * be called on it afterwards. Returns false if it can not be watched,
+   * e.g. it has no pidfd or is reaped by the ChildRegistry. A child that
+   * could not be reaped is reported with SubprocessReactor::kExitLost.
+   */
+  bool Watch(Subprocess& process, ExitCallback on_exit);
+
+  /*!
+   * Read a pipe, e.g. GetOutputFD() or GetErrorFD(), until EOF. The data
+   * passed to on_output is only valid during the call. The fd is not
+   * closed.
+   */
+  bool WatchOutput(int fd, OutputCallback on_output);
+
+  /*!
+   * Write a copy of data to fd, e.g. GetInputFD() after
+   * ReceiveInputFromPipe(). Writes to the same fd are made in order, one
+   * at a time; writes to different fds queued before the next RunOnce()
+   * go to the kernel in a single submission. Block or ignore SIGPIPE if
+   * the child may exit without reading its input.
+   */
+  bool Write(int fd, const char* data, size_t size,
+             WriteCallback on_written = WriteCallback());
+
+  /*!
+   * Submit queued work and wait up to timeout_ms (-1 for ever) for
+   * completions, then dispatch them. Returns the number handled or -1.
+   */
+  int RunOnce(int timeout_ms);
+
+  /// Dispatch completions until nothing is in flight anymore
+  void Run();
+
+  /// Watches and writes still in flight
+  size_t Pending() const;
+
+  /// System calls made by the engine so far, for benchmarks
+  uint64_t SyscallCount() const;
+
+ private:
+  enum OperationKind { kWaitid, kPidfdPoll, kRead, kWrite };
+
+  struct Operation {
+    OperationKind kind = kRead;
+    int fd = -1;     // pidfd for kWaitid/kPidfdPoll, owned by the engine
+    pid_t pid = -1;
+    std::chrono::steady_clock::time_point exec_time;  // of the child
+    ExitCallback on_exit;
+    OutputCallback on_output;
+    WriteCallback on_written;
+    std::string data;
+    size_t written = 0;
+    siginfo_t info = siginfo_t();  // filled by IORING_OP_WAITID
+  };
+
+  bool Setup(const UringOptions& options);
+  void Teardown();
+
+  uint64_t Add(Operation operation);
+  struct io_uring_sqe* NextSqe();
+  void Prepare(uint64_t token, Operation& operation);
+  int Enter(unsigned min_complete, int timeout_ms);
+  void Complete(uint64_t token, int result, unsigned flags);
+  void RecycleBuffer(unsigned buffer_id);
+
+  bool StartWrite(Operation operation);
+  void StartNextWrite(int fd);
+  bool ArmWrite(std::shared_ptr<Operation> pending);
+
+  // fallback engine, also used when the ring can not be set up
+  SubprocessReactor reactor_;
+
+  int ring_fd_ = -1;
+  bool uses_waitid_ = false;
+  bool multishot_read_ = false;
+  uint64_t syscalls_ = 0;
+
+  // submission and completion rings, shared with the kernel
+  void* ring_ = nullptr;
+  size_t ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned sq_pending_ = 0;  // prepared but not submitted yet
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  struct io_uring_cqe* cqes_ = nullptr;
+
+  // provided buffer ring and the buffers it hands out
+  struct io_uring_buf* buffer_ring_ = nullptr;
+  size_t buffer_ring_size_ = 0;
+  unsigned buffer_count_ = 0;
+  unsigned buffer_size_ = 0;
+  uint16_t buffer_tail_ = 0;
+  char* buffers_ = nullptr;
+
+  std::unordered_map<uint64_t, Operation> operations_;  // keyed by token
+
+  // writes waiting for the one in flight on the same fd, keyed by fd
+  std::unordered_map<int, std::deque<Operation>> write_queues_;
+  size_t queued_writes_ = 0;
+  uint64_t next_token_ = 1;
+};
+
+#endif  // DTU_COMMON_SUBPROCESS_URING_H_
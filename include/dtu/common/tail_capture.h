@@ -0,0 +1,106 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    tail_capture.h
+ * @brief   Declaration of TailBuffer and TailCapture
+ *          Keep only the last bytes a child writes, e.g. the end of the
+ *          stderr of a daemon for diagnostics when it fails, in a fixed
+ *          ring in the parent: memory stays the same however much the
+ *          child writes.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#ifndef DTU_COMMON_TAIL_CAPTURE_H_
+#define DTU_COMMON_TAIL_CAPTURE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "dtu/common/scoped_fd.h"
+
+/*!
+ * Ring of the last capacity bytes appended. The ring is allocated once,
+ * aligned to and rounded up to cache lines. Append() and Snapshot() may
+ * be called from different threads; both only hold the lock for the
+ * memcpy() of what they move.
+ */
+class TailBuffer {
+ public:
+  explicit TailBuffer(size_t capacity);
+
+  TailBuffer(const TailBuffer&) = delete;
+  TailBuffer& operator=(const TailBuffer&) = delete;
+
+  /// Keep the end of data, dropping the oldest bytes once full
+  void Append(const char* data, size_t size);
+
+  /// Last Capacity() bytes at most, oldest first
+  std::string Snapshot() const;
+
+  /// Every byte ever appended, kept or not
+  uint64_t TotalBytes() const { return total_.load(); }
+
+  size_t Capacity() const { return capacity_; }
+
+ private:
+  struct FreeDeleter {
+    void operator()(char* ring) const { free(ring); }
+  };
+
+  size_t capacity_;
+  std::unique_ptr<char, FreeDeleter> ring_;
+  mutable std::mutex mutex_;
+  uint64_t written_ = 0;  // position of the next byte, guarded by mutex_
+  std::atomic<uint64_t> total_{0};
+};
+
+/*!
+ * Drains fd into a TailBuffer on a thread of its own until EOF, e.g. the
+ * read end of SendErrorToPipe(), see Subprocess::SendErrorToTail(). For
+ * many children, feed TailBuffers from SubprocessReactor::WatchOutput()
+ * instead of running a thread each.
+ */
+class TailCapture {
+ public:
+  /// Take fd over and start draining it, capacity as in TailBuffer
+  TailCapture(ScopedFD fd, size_t capacity);
+
+  /// Stops draining, whether EOF was reached or not
+  ~TailCapture();
+
+  TailCapture(const TailCapture&) = delete;
+  TailCapture& operator=(const TailCapture&) = delete;
+
+  /// Safe from any thread, also while the child is still writing
+  std::string Snapshot() const { return buffer_.Snapshot(); }
+  uint64_t TotalBytes() const { return buffer_.TotalBytes(); }
+
+  /// True once EOF was read, every write of the child is in the buffer
+  bool Finished() const { return finished_.load(); }
+
+  /*!
+   * Block until EOF, i.e. until every process holding the write end
+   * closed it, a child that exited may have left it to its own children
+   */
+  void Wait();
+
+ private:
+  void Drain();
+
+  TailBuffer buffer_;
+  ScopedFD fd_;
+  ScopedFD stop_fd_;  // eventfd written by the destructor
+  std::atomic<bool> finished_{false};
+  std::mutex join_mutex_;
+  std::thread thread_;
+};
+
+#endif  // DTU_COMMON_TAIL_CAPTURE_H_
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    argv_arena.cc
+ * @brief   Implementation of ArgvArena
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/argv_arena.h"
+
+#include <utility>
+
+void ArgvArena::Allocate(size_t max_count, size_t bytes) {
+  // pointer table first, the new[] block is aligned for char*
+  block_size_ = (max_count + 1) * sizeof(char*) + bytes;
+  block_.reset(new char[block_size_]);
+  max_count_ = max_count;
+  count_ = 0;
+  used_bytes_ = 0;
+  table()[0] = nullptr;
+}
+
+void ArgvArena::Append(const char* arg, size_t length) {
+  char* bytes = block_.get() + (max_count_ + 1) * sizeof(char*);
+  char* dest = bytes + used_bytes_;
+  memcpy(dest, arg, length);
+  dest[length] = '\0';
+  used_bytes_ += length + 1;
+
+  table()[count_++] = dest;
+  table()[count_] = nullptr;
+}
+
+ArgvArena ArgvArena::FromCommandLine(const std::string& cmd,
+                                     const std::string& option) {
+  // every argument of option takes at least one byte and one separator
+  ArgvArena arena;
+  arena.Allocate(1 + (option.size() + 1) / 2 + 1,
+                 cmd.size() + 1 + option.size() + 1);
+  arena.Append(cmd.data(), cmd.size());
+  if (option.empty()) return arena;
+
+  // runs of spaces separate arguments, what follows the last space is
+  // always an argument, even if empty
+  size_t begin = 0;
+  size_t space;
+  while ((space = option.find(' ', begin)) != std::string::npos) {
+    if (space > begin) arena.Append(option.data() + begin, space - begin);
+    begin = space + 1;
+  }
+  if (!cmd.empty()) arena.Append(option.data() + begin, option.size() - begin);
+  return arena;
+}
+
+ArgvArena ArgvArena::FromShellWords(const std::string& cmd,
+                                    const std::string& option) {
+  // every argument of option takes at least one byte and one separator,
+  // and no argument is longer than the text it comes from
+  ArgvArena arena;
+  arena.Allocate(1 + (option.size() + 1) / 2,
+                 cmd.size() + 1 + option.size() + 1);
+  arena.Append(cmd.data(), cmd.size());
+
+  char* bytes = arena.block_.get() + (arena.max_count_ + 1) * sizeof(char*);
+  char* dest = nullptr;  // write position of the argument being built
+  char quote = '\0';
+
+  for (size_t i = 0; i < option.size(); ++i) {
+    char c = option[i];
+
+    if (!quote && (c == ' ' || c == '\t' || c == '\n')) {
+      if (dest) {
+        *dest++ = '\0';
+        arena.used_bytes_ = dest - bytes;
+        dest = nullptr;
+      }
+      continue;
+    }
+
+    if (!dest) {
+      dest = bytes + arena.used_bytes_;
+      arena.table()[arena.count_++] = dest;
+      arena.table()[arena.count_] = nullptr;
+    }
+
+    if (quote == '\'') {
+      if (c == '\'') quote = '\0'; else *dest++ = c;
+    } else if (c == '\\' && i + 1 < option.size() &&
+               (!quote || option[i + 1] == '"' || option[i + 1] == '\\')) {
+      *dest++ = option[++i];
+    } else if (quote == '"') {
+      if (c == '"') quote = '\0'; else *dest++ = c;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else {
+      *dest++ = c;
+    }
+  }
+
+  if (dest) {
+    *dest++ = '\0';
+    arena.used_bytes_ = dest - bytes;
+  }
+  return arena;
+}
+
+ArgvArena::ArgvArena(const ArgvArena& other)
+    : block_size_(other.block_size_), max_count_(other.max_count_),
+      count_(other.count_), used_bytes_(other.used_bytes_) {
+  if (!other.block_) return;
+  block_.reset(new char[block_size_]);
+  memcpy(block_.get(), other.block_.get(), block_size_);
+
+  // the copied table still points into other, move it onto our block
+  for (size_t i = 0; i < count_; ++i) {
+    table()[i] = block_.get() + (other.table()[i] - other.block_.get());
+  }
+}
+
+ArgvArena::ArgvArena(ArgvArena&& other) noexcept
+    : block_(std::move(other.block_)), block_size_(other.block_size_),
+      max_count_(other.max_count_), count_(other.count_),
+      used_bytes_(other.used_bytes_) {
+  other.block_size_ = other.max_count_ = other.count_ = 0;
+  other.used_bytes_ = 0;
+}
+
+ArgvArena& ArgvArena::operator=(ArgvArena other) noexcept {
+  std::swap(block_, other.block_);
+  std::swap(block_size_, other.block_size_);
+  std::swap(max_count_, other.max_count_);
+  std::swap(count_, other.count_);
+  std::swap(used_bytes_, other.used_bytes_);
+  return *this;
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    child_registry.cc
+ * @brief   Implementation of ExitSlot and ChildRegistry
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/child_registry.h"
+
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "dtu/util/switch_logging.h"
+
+// waitid() id type of a pidfd, from Linux 5.4
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define REAP_BATCH_SIZE 256
+#define SUCCESS 0
+#define ERROR -1
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int),
+              "ExitSlot state is used as a futex word");
+
+static int* FutexWord(std::atomic<int>* state) {
+  return reinterpret_cast<int*>(state);
+}
+
+// waitpid() status word from what waitid() reports
+static int WaitStatus(const siginfo_t& info) {
+  switch (info.si_code) {
+    case CLD_EXITED:
+      return (info.si_status & 0xff) << 8;
+    case CLD_DUMPED:
+      return info.si_status | 0x80;
+    default:
+      return info.si_status;
+  }
+}
+
+ExitSlot::State ExitSlot::Wait() const {
+  while (!WaitUntil(std::chrono::steady_clock::time_point::max())) {
+  }
+  return state();
+}
+
+bool ExitSlot::WaitUntil(
+    std::chrono::steady_clock::time_point deadline) const {
+  if (Done()) return true;
+
+  // announced before the state is checked again, so that the reaper
+  // either sees a waiter or the waiter sees the new state
+  waiters_.fetch_add(1);
+  while (!Done()) {
+    struct timespec timeout;
+    struct timespec* timeout_ptr = nullptr;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) break;
+      timeout.tv_sec = remaining.count() / 1000000000;
+      timeout.tv_nsec = remaining.count() % 1000000000;
+      timeout_ptr = &timeout;
+    }
+    // returns at once with EAGAIN if the state changed meanwhile
+    syscall(SYS_futex, FutexWord(&state_), FUTEX_WAIT_PRIVATE, kRunning,
+            timeout_ptr, nullptr, 0);
+  }
+  waiters_.fetch_sub(1);
+  return Done();
+}
+
+ChildRegistry& ChildRegistry::Instance() {
+  static ChildRegistry registry;
+  return registry;
+}
+
+ChildRegistry::~ChildRegistry() {
+  if (thread_.joinable()) {
+    uint64_t stop = 1;
+    ssize_t size = write(stop_fd_.get(), &stop, sizeof(stop));
+    (void)size;
+    thread_.join();
+  }
+}
+
+bool ChildRegistry::StartLocked() {
+  if (thread_.joinable()) return true;
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == ERROR) {
+    EFDLOG(SUBPROC) << "Error during epoll_create1():\n" << strerror(errno);
+    return false;
+  }
+  epoll_fd_.Reset(epoll_fd);
+
+  int stop_fd = eventfd(0, EFD_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = stop_fd;
+  if (stop_fd == ERROR ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) == ERROR) {
+    EFDLOG(SUBPROC) << "Child registry not started:\n" << strerror(errno);
+    if (stop_fd != ERROR) close(stop_fd);
+    epoll_fd_.Reset();
+    return false;
+  }
+  stop_fd_.Reset(stop_fd);
+
+  thread_ = std::thread(&ChildRegistry::ReapChildren, this);
+  return true;
+}
+
+std::shared_ptr<const ExitSlot> ChildRegistry::Register(pid_t pid,
+                                                        ScopedFD* pidfd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!StartLocked()) return nullptr;
+
+  int fd = pidfd->get();
+  std::shared_ptr<ExitSlot> slot(new ExitSlot(pid, std::move(*pidfd)));
+  children_[fd] = slot;
+  pending_.fetch_add(1);
+
+  // an exited child is readable at once, so no exit can be missed
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &event) == ERROR) {
+    int error = errno;
+    EFDLOG(SUBPROC) << "Error during epoll_ctl() on pidfd:\n"
+                    << strerror(error);
+    children_.erase(fd);
+    pending_.fetch_sub(1);
+    // back to the caller, as if never registered
+    *pidfd = std::move(slot->pidfd_);
+    errno = error;
+    return nullptr;
+  }
+  return slot;
+}
+
+void ChildRegistry::ReapChildren() {
+  struct epoll_event events[REAP_BATCH_SIZE];
+  while (true) {
+    int count = epoll_wait(epoll_fd_.get(), events, REAP_BATCH_SIZE, -1);
+    if (count == ERROR) {
+      if (errno == EINTR) continue;
+      EFDLOG(SUBPROC) << "Error during epoll_wait():\n" << strerror(errno);
+      return;
+    }
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.fd == stop_fd_.get()) return;
+      Reap(events[i].data.fd);
+    }
+  }
+}
+
+void ChildRegistry::Reap(int pidfd) {
+  std::chrono::steady_clock::time_point exit_time =
+      std::chrono::steady_clock::now();
+
+  // the glibc wrapper of waitid() has no rusage argument
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  long ret = syscall(SYS_waitid, P_PIDFD, pidfd, &info,
+                     WEXITED | WNOHANG | __WALL, &usage);
+  int error = errno;
+  // si_pid stays 0 if the child is somehow still running
+  if (ret == SUCCESS && info.si_pid == SUCCESS) return;
+
+  std::shared_ptr<ExitSlot> slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = children_.find(pidfd);
+    if (it == children_.end()) return;
+    slot = std::move(it->second);
+    children_.erase(it);
+  }
+  // left open in the slot, the owner may still signal through it
+  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_DEL, pidfd, nullptr);
+
+  slot->exit_time_ = exit_time;
+  int state = ExitSlot::kExited;
+  if (ret == ERROR) {
+    EFDLOG(SUBPROC) << "Error during waitid() on pidfd of " << slot->pid_
+                    << ":\n" << strerror(error);
+    slot->error_ = error;
+    state = ExitSlot::kLost;
+  } else {
+    slot->wait_status_ = WaitStatus(info);
+    slot->usage_ = usage;
+  }
+
+  // the fields above are visible to whoever sees the new state
+  pending_.fetch_sub(1);
+  slot->state_.store(state);
+  if (slot->waiters_.load() > 0) {
+    syscall(SYS_futex, FutexWord(&slot->state_), FUTEX_WAKE_PRIVATE, INT_MAX,
+            nullptr, nullptr, 0);
+  }
+}
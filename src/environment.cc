@@ -0,0 +1,80 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    environment.cc
+ * @brief   Implementation of Environment and EnvironmentBuilder
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/environment.h"
+
+#include <cstring>
+
+#include "dtu/util/switch_logging.h"
+
+extern char** environ;
+
+const char* Environment::Get(const std::string& name) const {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const char* entry = entries_[i];
+    if (strncmp(entry, name.c_str(), name.size()) == 0 &&
+        entry[name.size()] == '=') {
+      return entry + name.size() + 1;
+    }
+  }
+  return nullptr;
+}
+
+EnvironmentBuilder EnvironmentBuilder::FromParent() {
+  EnvironmentBuilder builder;
+  for (char** entry = environ; entry && *entry; ++entry) {
+    builder.entries_.push_back(*entry);
+  }
+  return builder;
+}
+
+std::vector<std::string>::iterator EnvironmentBuilder::Find(
+    const std::string& name) {
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->size() > name.size() && (*it)[name.size()] == '=' &&
+        it->compare(0, name.size(), name) == 0) {
+      return it;
+    }
+  }
+  return entries_.end();
+}
+
+EnvironmentBuilder& EnvironmentBuilder::Set(const std::string& name,
+                                            const std::string& value) {
+  if (name.empty() || name.find('=') != std::string::npos) {
+    EFDLOG(SUBPROC) << "Invalid environment variable name: " << name;
+    return *this;
+  }
+  auto it = Find(name);
+  if (it == entries_.end()) {
+    entries_.push_back(name + '=' + value);
+  } else {
+    *it = name + '=' + value;
+  }
+  return *this;
+}
+
+EnvironmentBuilder& EnvironmentBuilder::Unset(const std::string& name) {
+  auto it = Find(name);
+  if (it != entries_.end()) entries_.erase(it);
+  return *this;
+}
+
+EnvironmentBuilder& EnvironmentBuilder::Clear() {
+  entries_.clear();
+  return *this;
+}
+
+std::shared_ptr<const Environment> EnvironmentBuilder::Build() const {
+  // the constructor is private, so no make_shared
+  return std::shared_ptr<const Environment>(
+      new Environment(ArgvArena(entries_.begin(), entries_.end())));
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    executable_cache.cc
+ * @brief   Implementation of ExecutableCache
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/executable_cache.h"
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#define ERROR -1
+#define SUCCESS 0
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define WATCH_EVENTS                                                      \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |      \
+   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+ExecutableCache& ExecutableCache::Instance() {
+  static ExecutableCache cache;
+  return cache;
+}
+
+std::string ExecutableCache::Resolve(const char* name,
+                                     const char* search_path, int* error) {
+  if (!search_path) search_path = DEFAULT_PATH;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!enabled_) {
+    Entry entry = Search(name, search_path, false);
+    *error = entry.error;
+    return entry.path;
+  }
+
+  DrainEvents();
+  std::string key(name);
+  key.append(1, '\0').append(search_path);
+  auto found = entries_.find(key);
+  if (found == entries_.end() || !StillValid(found->second)) {
+    Entry entry = Search(name, search_path, true);
+    // relative PATH entries depend on the cwd of the child, never cached
+    if (!entry.cacheable) {
+      *error = entry.error;
+      return entry.path;
+    }
+    found = entries_.insert(std::make_pair(key, std::move(entry))).first;
+  }
+  *error = found->second.error;
+  return found->second.path;
+}
+
+void ExecutableCache::SetEnabled(bool enabled) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = enabled;
+  entries_.clear();
+}
+
+bool ExecutableCache::IsEnabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return enabled_;
+}
+
+void ExecutableCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+uint64_t ExecutableCache::SearchCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return searches_;
+}
+
+uint64_t ExecutableCache::SyscallCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return syscalls_;
+}
+
+ExecutableCache::Entry ExecutableCache::Search(const char* name,
+                                               const char* search_path,
+                                               bool watch) {
+  ++searches_;
+  Entry entry;
+  entry.error = ENOENT;
+  entry.cacheable = true;
+
+  std::string candidate;
+  for (const char* dir = search_path;; ++dir) {
+    const char* end = strchr(dir, ':');
+    if (!end) end = dir + strlen(dir);
+    candidate.assign(dir, end);
+
+    // an empty entry is the cwd, leave relative entries to the child
+    if (candidate.empty() || candidate[0] != '/') {
+      entry.error = SUCCESS;
+      entry.cacheable = false;
+      return entry;
+    }
+    if (watch && !Watch(candidate)) {
+      UnwatchedDir unwatched;
+      unwatched.dir = candidate;
+      unwatched.exists = Stat(candidate, &unwatched.mtime);
+      entry.unwatched.push_back(unwatched);
+    }
+
+    candidate.append(1, '/').append(name);
+    struct stat file_stat;
+    ++syscalls_;
+    if (stat(candidate.c_str(), &file_stat) == SUCCESS &&
+        S_ISREG(file_stat.st_mode)) {
+      ++syscalls_;
+      if (access(candidate.c_str(), X_OK) == SUCCESS) {
+        entry.path = candidate;
+        entry.error = SUCCESS;
+        return entry;
+      }
+      // as execvp(), keep looking but report EACCES if nothing is found
+      entry.error = EACCES;
+    }
+    if (*end == '\0') break;
+    dir = end;
+  }
+  return entry;
+}
+
+bool ExecutableCache::Stat(const std::string& dir, struct timespec* mtime) {
+  struct stat dir_stat;
+  ++syscalls_;
+  if (stat(dir.c_str(), &dir_stat) == ERROR) return false;
+  *mtime = dir_stat.st_mtim;
+  return true;
+}
+
+bool ExecutableCache::Watch(const std::string& dir) {
+  if (watched_dirs_.count(dir)) return true;
+  if (inotify_failed_) return false;
+
+  if (!inotify_fd_.valid()) {
+    ++syscalls_;
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == ERROR) {
+      inotify_failed_ = true;
+      return false;
+    }
+    inotify_fd_.Reset(fd);
+  }
+
+  // missing directories are checked by mtime until they appear
+  ++syscalls_;
+  int wd = inotify_add_watch(inotify_fd_.get(), dir.c_str(), WATCH_EVENTS);
+  if (wd == ERROR) return false;
+  watched_dirs_[dir] = wd;
+  return true;
+}
+
+void ExecutableCache::DrainEvents() {
+  if (!inotify_fd_.valid()) return;
+
+  alignas(struct inotify_event) char buffer[4096];
+  for (;;) {
+    ++syscalls_;
+    ssize_t size = read(inotify_fd_.get(), buffer, sizeof(buffer));
+    if (size <= 0) break;
+
+    // any change in a searched directory may change any resolution
+    entries_.clear();
+    for (char* next = buffer; next < buffer + size;) {
+      struct inotify_event* event =
+          reinterpret_cast<struct inotify_event*>(next);
+      if (event->mask & IN_IGNORED) {
+        for (auto it = watched_dirs_.begin(); it != watched_dirs_.end();
+             ++it) {
+          if (it->second == event->wd) {
+            watched_dirs_.erase(it);
+            break;
+          }
+        }
+      }
+      next += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+bool ExecutableCache::StillValid(const Entry& entry) {
+  for (const UnwatchedDir& unwatched : entry.unwatched) {
+    struct timespec mtime;
+    bool exists = Stat(unwatched.dir, &mtime);
+    if (exists != unwatched.exists) return false;
+    if (exists && (mtime.tv_sec != unwatched.mtime.tv_sec ||
+                   mtime.tv_nsec != unwatched.mtime.tv_nsec)) {
+      return false;
+    }
+  }
+  return true;
+}
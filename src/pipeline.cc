@@ -0,0 +1,94 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    pipeline.cc
+ * @brief   Implementation of Pipeline
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/pipeline.h"
+
+#define FD_READ_END 0
+#define FD_WRITE_END 1
+#define ERROR -1
+#define NOT_EXIST -1
+#define SUCCESS 0
+
+Pipeline& Pipeline::Add(Subprocess& stage) {
+  stages_.push_back(&stage);
+  return *this;
+}
+
+void Pipeline::SetPipeCapacity(int bytes) {
+  pipe_capacity_ = bytes;
+}
+
+bool Pipeline::Start() {
+  int previous_read_end = NOT_EXIST;
+
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    int fd[FD_SIZE] = {NOT_EXIST, NOT_EXIST};
+    if (i + 1 < stages_.size()) {
+      // close-on-exec, so only the two stages it connects inherit it
+      if (pipe2(fd, O_CLOEXEC) == ERROR) {
+        EFDLOG(SUBPROC) << "PIPE creation failed:\n" << strerror(errno);
+        if (previous_read_end != NOT_EXIST) close(previous_read_end);
+        if (i > 0) stages_[i]->ReceiveInputFromFile(NOT_EXIST);
+        StopStarted(i);
+        return false;
+      }
+      if (pipe_capacity_ > 0 &&
+          fcntl(fd[FD_WRITE_END], F_SETPIPE_SZ, pipe_capacity_) == ERROR) {
+        EFDLOG(SUBPROC) << "Error during F_SETPIPE_SZ:\n" << strerror(errno);
+      }
+      stages_[i]->SendOutputToFile(fd[FD_WRITE_END]);
+      stages_[i + 1]->ReceiveInputFromFile(fd[FD_READ_END]);
+    }
+
+    // stages only borrow the pipe ends, drop ours once the child has them
+    stages_[i]->Start();
+    bool started = stages_[i]->GetPID() != ERROR;
+    if (previous_read_end != NOT_EXIST) close(previous_read_end);
+    if (fd[FD_WRITE_END] != NOT_EXIST) close(fd[FD_WRITE_END]);
+    previous_read_end = fd[FD_READ_END];
+    if (!started) {
+      // the failed stage and the next one must not keep the closed ends
+      if (i > 0) stages_[i]->ReceiveInputFromFile(NOT_EXIST);
+      if (i + 1 < stages_.size()) {
+        stages_[i]->SendOutputToFile(NOT_EXIST);
+        stages_[i + 1]->ReceiveInputFromFile(NOT_EXIST);
+      }
+      if (previous_read_end != NOT_EXIST) close(previous_read_end);
+      StopStarted(i);
+      return false;
+    }
+  }
+  return true;
+}
+
+void Pipeline::StopStarted(size_t count) {
+  // the stages would block on a pipe nobody drains or fills, never
+  // leave them running or unreaped
+  for (size_t i = 0; i < count; ++i) {
+    stages_[i]->SubprocessKill();
+    stages_[i]->SubprocessWait();
+  }
+}
+
+std::vector<int> Pipeline::Wait() {
+  statuses_.clear();
+  for (Subprocess* stage : stages_) {
+    statuses_.push_back(stage->SubprocessWait());
+  }
+  return statuses_;
+}
+
+int Pipeline::PipefailStatus() const {
+  for (auto it = statuses_.rbegin(); it != statuses_.rend(); ++it) {
+    if (*it != SUCCESS) return *it;
+  }
+  return SUCCESS;
+}
@@ -0,0 +1,88 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    record_reader.cc
+ * @brief   Implementation of RecordReader
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/record_reader.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#define ERROR -1
+
+RecordReader::RecordReader(int fd, char delimiter, size_t capacity)
+    : fd_(fd),
+      delimiter_(delimiter),
+      buffer_(new char[capacity ? capacity : 1]),
+      capacity_(capacity ? capacity : 1) {}
+
+RecordReader::Status RecordReader::Next(RecordView* record) {
+  while (true) {
+    // only the bytes read since the last scan are searched
+    char* start = buffer_.get() + begin_;
+    char* found = static_cast<char*>(
+        memchr(buffer_.get() + scanned_, delimiter_, end_ - scanned_));
+    if (found) {
+      record->data = start;
+      record->size = found - start;
+      begin_ = scanned_ = found - buffer_.get() + 1;
+      ++count_;
+      return kRecord;
+    }
+    scanned_ = end_;
+
+    if (eof_) {
+      if (begin_ == end_) return kEndOfStream;
+      record->data = start;
+      record->size = end_ - begin_;
+      begin_ = scanned_ = end_;
+      ++count_;
+      return kRecord;
+    }
+
+    Status status = Fill();
+    if (status != kRecord) return status;
+  }
+}
+
+RecordReader::Status RecordReader::Fill() {
+  if (end_ == capacity_) {
+    size_t pending = end_ - begin_;
+    if (begin_ == 0) {
+      // one record fills the buffer, grow it for good
+      size_t capacity = capacity_ * 2;
+      std::unique_ptr<char[]> buffer(new char[capacity]);
+      memcpy(buffer.get(), buffer_.get(), pending);
+      buffer_.swap(buffer);
+      capacity_ = capacity;
+    } else {
+      // records handed out before are invalid now, compact to the front
+      memmove(buffer_.get(), buffer_.get() + begin_, pending);
+    }
+    scanned_ -= begin_;
+    begin_ = 0;
+    end_ = pending;
+  }
+
+  ssize_t size;
+  do {
+    size = read(fd_, buffer_.get() + end_, capacity_ - end_);
+  } while (size == ERROR && errno == EINTR);
+
+  if (size > 0) {
+    end_ += size;
+  } else if (size == 0) {
+    eof_ = true;
+  } else {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? kWouldBlock : kReadError;
+  }
+  return kRecord;
+}
@@ -0,0 +1,48 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    scoped_fd.cc
+ * @brief   Implementation of ScopedFD
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/scoped_fd.h"
+
+#include <unistd.h>
+
+ScopedFD::~ScopedFD() {
+  Reset();
+}
+
+ScopedFD::ScopedFD(ScopedFD&& other) noexcept
+    : fd_(other.fd_), owned_(other.owned_) {
+  other.fd_ = -1;
+  other.owned_ = false;
+}
+
+ScopedFD& ScopedFD::operator=(ScopedFD&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    fd_ = other.fd_;
+    owned_ = other.owned_;
+    other.fd_ = -1;
+    other.owned_ = false;
+  }
+  return *this;
+}
+
+void ScopedFD::Reset(int fd) {
+  // close() is not retried on EINTR, the descriptor is gone either way
+  if (owned_ && fd_ != -1) close(fd_);
+  fd_ = fd;
+  owned_ = fd != -1;
+}
+
+void ScopedFD::Borrow(int fd) {
+  Reset();
+  fd_ = fd;
+  owned_ = false;
+}
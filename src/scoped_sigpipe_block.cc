@@ -0,0 +1,33 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    scoped_sigpipe_block.cc
+ * @brief   Implementation of ScopedSigpipeBlock
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/scoped_sigpipe_block.h"
+
+#include <pthread.h>
+#include <time.h>
+
+ScopedSigpipeBlock::ScopedSigpipeBlock() {
+  sigemptyset(&sigpipe_set_);
+  sigaddset(&sigpipe_set_, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe_set_, &old_set_);
+  sigset_t pending_set;
+  sigpending(&pending_set);
+  was_pending_ = sigismember(&pending_set, SIGPIPE);
+}
+
+ScopedSigpipeBlock::~ScopedSigpipeBlock() {
+  // only discard what we raised ourselves
+  if (!was_pending_) {
+    struct timespec no_wait = {0, 0};
+    sigtimedwait(&sigpipe_set_, nullptr, &no_wait);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_set_, nullptr);
+}
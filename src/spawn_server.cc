@@ -0,0 +1,388 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    spawn_server.cc
+ * @brief   Implementation of SpawnServer
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/spawn_server.h"
+
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "dtu/common/subprocess.h"
+
+#define NOT_EXIST -1
+#define ERROR -1
+#define STDIO_FDS 3
+// stdio and the current directory of the caller
+#define REQUEST_FDS 4
+#define MAX_REQUEST_SIZE 131072
+
+// Request header, followed by the NUL terminated file and arguments, then
+// the environment entries
+struct SpawnRequest {
+  uint32_t path;
+  uint32_t argv_bytes;
+  uint32_t envp_bytes;
+};
+
+struct SpawnReply {
+  int32_t pid;
+  int32_t error;
+};
+
+static bool SendWithFDs(int socket_fd, const void* header, size_t header_size,
+                        const std::string& payload, const int* fds,
+                        int fd_count) {
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<void*>(header);
+  iov[0].iov_len = header_size;
+  iov[1].iov_base = const_cast<char*>(payload.data());
+  iov[1].iov_len = payload.size();
+
+  union {
+    char buffer[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = iov;
+  message.msg_iovlen = payload.empty() ? 1 : 2;
+  if (fd_count) {
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+  }
+
+  while (sendmsg(socket_fd, &message, MSG_NOSIGNAL) == ERROR) {
+    if (errno != EINTR) return false;
+  }
+  return true;
+}
+
+static ssize_t ReceiveWithFDs(int socket_fd, void* buffer, size_t size,
+                              int* fds, int max_fds, int* fd_count) {
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+
+  union {
+    char buffer[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    struct cmsghdr align;
+  } control;
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  ssize_t received;
+  do {
+    received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+  } while (received == ERROR && errno == EINTR);
+
+  *fd_count = 0;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int* received_fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+    for (int i = 0; i < count; ++i) {
+      if (*fd_count < max_fds) {
+        fds[(*fd_count)++] = received_fds[i];
+      } else {
+        close(received_fds[i]);
+      }
+    }
+  }
+  return received;
+}
+
+// errno to the helper through the status pipe, then exit
+static void ReportErrorInSibling(int status_fd) {
+  int error = errno;
+  while (write(status_fd, &error, sizeof(error)) == ERROR &&
+         errno == EINTR) {
+  }
+  _exit(EXIT_FAILURE);
+}
+
+/*
+ * Runs in the helper. CLONE_PARENT makes the new process a child of the
+ * helper's parent, CLONE_VFORK keeps the helper small by waiting for exec.
+ * The sibling takes the environment and directory of the request, not
+ * the ones the helper was forked with.
+ */
+static pid_t LaunchSibling(const char* file, char* const* argv,
+                           char** envp, bool path, const int* stdio,
+                           int cwd_fd, int* pidfd, int* exec_error) {
+#ifdef SYS_clone3
+  // close-on-exec, the sibling writes errno into it only if exec fails
+  int status[FD_SIZE];
+  if (pipe2(status, O_CLOEXEC) == ERROR) return ERROR;
+
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_PARENT | CLONE_PIDFD | CLONE_VFORK;
+  args.pidfd = reinterpret_cast<uint64_t>(pidfd);
+
+  long pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == 0) {
+    // received fds are close-on-exec, dup2() clears it on the copies
+    for (int target_fd = 0; target_fd < STDIO_FDS; ++target_fd) {
+      if (stdio[target_fd] != target_fd &&
+          dup2(stdio[target_fd], target_fd) == ERROR) {
+        ReportErrorInSibling(status[1]);
+      }
+    }
+    if (fchdir(cwd_fd) == ERROR) ReportErrorInSibling(status[1]);
+    if (path) {
+      execve(file, argv, envp);
+    } else {
+      // the sibling has its own memory, execvpe() searches this PATH
+      environ = envp;
+      execvpe(file, argv, envp);
+    }
+    ReportErrorInSibling(status[1]);
+  }
+
+  int clone_error = errno;
+  close(status[1]);
+  if (pid != ERROR) {
+    ssize_t size;
+    do {
+      size = read(status[0], exec_error, sizeof(*exec_error));
+    } while (size == ERROR && errno == EINTR);
+    if (size != sizeof(*exec_error)) *exec_error = 0;
+  }
+  close(status[0]);
+  errno = clone_error;
+  return pid;
+#else
+  errno = ENOSYS;
+  return ERROR;
+#endif
+}
+
+// Keep stdio and the request socket, drop whatever the parent had open
+static void CloseInheritedFDs(int keep_fd) {
+#ifdef SYS_close_range
+  if ((keep_fd == STDERR_FILENO + 1 ||
+       syscall(SYS_close_range, STDERR_FILENO + 1, keep_fd - 1, 0) == 0) &&
+      syscall(SYS_close_range, keep_fd + 1, ~0U, 0) == 0) {
+    return;
+  }
+#endif
+  int max_fd = getdtablesize();
+  for (int fd = STDERR_FILENO + 1; fd < max_fd; ++fd) {
+    if (fd != keep_fd) close(fd);
+  }
+}
+
+SpawnServer& SpawnServer::Instance() {
+  static SpawnServer server;
+  return server;
+}
+
+SpawnServer::~SpawnServer() {
+  Stop();
+}
+
+bool SpawnServer::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (socket_fd_ != NOT_EXIST) return true;
+
+  int fds[FD_SIZE];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == ERROR) {
+    EFDLOG(SUBPROC) << "Error during socketpair():\n" << strerror(errno);
+    return false;
+  }
+
+  pid_t pid = fork();
+  if (pid == ERROR) {
+    EFDLOG(SUBPROC) << "Spawn server creation Failed:\n" << strerror(errno);
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    CloseInheritedFDs(fds[1]);
+    ServeRequests(fds[1]);
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(fds[1]);
+  socket_fd_ = fds[0];
+  helper_pid_ = pid;
+  return true;
+}
+
+void SpawnServer::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (socket_fd_ == NOT_EXIST) return;
+
+  // the helper exits once it reads EOF
+  close(socket_fd_);
+  socket_fd_ = NOT_EXIST;
+  waitpid(helper_pid_, nullptr, 0);
+  helper_pid_ = NOT_EXIST;
+}
+
+bool SpawnServer::IsRunning() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return socket_fd_ != NOT_EXIST;
+}
+
+pid_t SpawnServer::Spawn(const char* file, char* const* argv,
+                         char* const* envp, bool path, const int stdio[3],
+                         int* pidfd, int* exec_error) {
+  *exec_error = 0;
+  std::string payload(file, strlen(file) + 1);
+  for (char* const* arg = argv; *arg; ++arg) {
+    payload.append(*arg, strlen(*arg) + 1);
+  }
+  size_t argv_bytes = payload.size();
+  for (char* const* entry = envp; *entry; ++entry) {
+    payload.append(*entry, strlen(*entry) + 1);
+  }
+  if (payload.size() + sizeof(SpawnRequest) > MAX_REQUEST_SIZE) {
+    errno = E2BIG;
+    return ERROR;
+  }
+
+  SpawnRequest request;
+  request.path = path;
+  request.argv_bytes = argv_bytes;
+  request.envp_bytes = payload.size() - argv_bytes;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (socket_fd_ == NOT_EXIST) {
+    errno = ENOTCONN;
+    return ERROR;
+  }
+  // the directory of the caller now, which the helper can not know
+  int fds[REQUEST_FDS] = {stdio[0], stdio[1], stdio[2], NOT_EXIST};
+  fds[STDIO_FDS] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fds[STDIO_FDS] == ERROR) return ERROR;
+  bool sent = SendWithFDs(socket_fd_, &request, sizeof(request), payload,
+                          fds, REQUEST_FDS);
+  int error = errno;
+  close(fds[STDIO_FDS]);
+  if (!sent) {
+    errno = error;
+    return ERROR;
+  }
+
+  SpawnReply reply;
+  int fd_count = 0;
+  ssize_t size = ReceiveWithFDs(socket_fd_, &reply, sizeof(reply), pidfd, 1,
+                                &fd_count);
+  if (size != sizeof(reply)) {
+    // the helper may have launched the child before the reply got lost,
+    // launching it again elsewhere could run the command twice
+    int error = size == ERROR ? errno : EPIPE;
+    EFDLOG(SUBPROC) << "Spawn server reply lost, stopping the server:\n"
+                    << strerror(error);
+    close(socket_fd_);
+    socket_fd_ = NOT_EXIST;
+    waitpid(helper_pid_, nullptr, 0);
+    helper_pid_ = NOT_EXIST;
+    *exec_error = error;
+    errno = error;
+    return ERROR;
+  }
+  if (reply.pid == ERROR) {
+    errno = reply.error;
+    return ERROR;
+  }
+  if (!fd_count) *pidfd = NOT_EXIST;
+
+  // the sibling is our child, reap it now that its exec failed
+  if (reply.error != 0) {
+    if (*pidfd != NOT_EXIST) close(*pidfd);
+    *pidfd = NOT_EXIST;
+    waitpid(reply.pid, nullptr, 0);
+    *exec_error = reply.error;
+    errno = reply.error;
+    return ERROR;
+  }
+  return reply.pid;
+}
+
+void SpawnServer::ServeRequests(int socket_fd) {
+  std::vector<char> buffer(MAX_REQUEST_SIZE);
+
+  while (true) {
+    int fds[REQUEST_FDS];
+    int fd_count = 0;
+    ssize_t size = ReceiveWithFDs(socket_fd, buffer.data(), buffer.size(),
+                                  fds, REQUEST_FDS, &fd_count);
+    // EOF, the parent stopped the server or went away
+    if (size <= 0) break;
+
+    SpawnReply reply;
+    reply.pid = ERROR;
+    reply.error = EINVAL;
+    int pidfd = NOT_EXIST;
+
+    SpawnRequest request;
+    if (static_cast<size_t>(size) >= sizeof(request) &&
+        static_cast<size_t>(size) < buffer.size() &&
+        fd_count == REQUEST_FDS) {
+      buffer[size] = '\0';
+      memcpy(&request, buffer.data(), sizeof(request));
+      char* arg = buffer.data() + sizeof(request);
+      char* payload_end = buffer.data() + size;
+      char* end = arg + std::min<size_t>(request.argv_bytes,
+                                         payload_end - arg);
+      std::vector<char*> argv;
+      while (arg < end) {
+        argv.push_back(arg);
+        arg += strlen(arg) + 1;
+      }
+      argv.push_back(nullptr);
+      end = arg + std::min<size_t>(request.envp_bytes, payload_end - arg);
+      std::vector<char*> envp;
+      while (arg < end) {
+        envp.push_back(arg);
+        arg += strlen(arg) + 1;
+      }
+      envp.push_back(nullptr);
+
+      // the file comes first, then at least argv[0]
+      if (argv.size() > 2) {
+        int exec_error = 0;
+        reply.pid = LaunchSibling(argv[0], argv.data() + 1, envp.data(),
+                                  request.path, fds, fds[STDIO_FDS], &pidfd,
+                                  &exec_error);
+        reply.error = reply.pid == ERROR ? errno : exec_error;
+      }
+    }
+
+    for (int i = 0; i < fd_count; ++i) close(fds[i]);
+    SendWithFDs(socket_fd, &reply, sizeof(reply), std::string(), &pidfd,
+                pidfd != NOT_EXIST);
+    if (pidfd != NOT_EXIST) close(pidfd);
+  }
+}
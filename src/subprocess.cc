@@ -15,8 +15,26 @@
  */
 
 #include "dtu/common/subprocess.h"
+#include "dtu/common/child_registry.h"
+#include "dtu/common/executable_cache.h"
+#include "dtu/common/pipeline.h"
+#include "dtu/common/scoped_sigpipe_block.h"
+#include "dtu/common/spawn_server.h"
+#include "dtu/common/subprocess_trace.h"
+#include "dtu/common/tail_capture.h"
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
 
-#define SPACE " "
 #define READ_WRITE_PERMISSION 0640
 #define NOT_EXIST -1
 #define FD_READ_END 0
@@ -25,173 +43,909 @@
 #define DEV_NULL "/dev/null"
 #define ERROR -1
 #define SUCCESS 0
-#define SIGNAL 0
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define CGROUP_STAT_SIZE 4096
+#define CHILD_STACK_SIZE 65536
+
+// posix_spawn_file_actions_addclosefrom_np() appeared in glibc 2.34
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_SPAWN_CLOSEFROM
+#endif
+// posix_spawn_file_actions_add(f)chdir_np() appeared in glibc 2.29
+#if __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR
+#endif
+#endif
+
+// POSIX_SPAWN_SETSID appeared in glibc 2.26
+#ifdef POSIX_SPAWN_SETSID
+#define HAVE_SPAWN_SETSID
+#endif
+
+// pidfd_send_signal() flag of <linux/pidfd.h> from Linux 6.9
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2)
+#endif
+
+extern char** environ;
+
+// dup2() fd onto target_fd in the child, async-signal-safe
+static bool RedirectInChild(int fd, int target_fd) {
+  return fd == NOT_EXIST || fd == target_fd || dup2(fd, target_fd) != ERROR;
+}
+
+// move the child to a group or session of its own, async-signal-safe
+static bool JoinProcessGroupInChild(ProcessGroupMode mode) {
+  if (mode == kNewProcessGroup) return setpgid(0, 0) != ERROR;
+  if (mode == kNewSession) return setsid() != ERROR;
+  return true;
+}
+
+// linear search of fds, async-signal-safe
+static bool ContainsFD(const int* fds, size_t count, int fd) {
+  for (size_t i = 0; i < count; ++i) {
+    if (fds[i] == fd) return true;
+  }
+  return false;
+}
+
+// close the original of a redirected fd unless it is a standard stream
+// or inherited as well
+static void CloseRedirectedInChild(int fd, const int* kept,
+                                   size_t kept_count) {
+  if (fd > STDERR_FILENO && !ContainsFD(kept, kept_count, fd)) close(fd);
+}
+
+// let the kept fds survive exec, async-signal-safe
+static bool ClearCloseOnExecInChild(const int* kept, size_t kept_count) {
+  for (size_t i = 0; i < kept_count; ++i) {
+    if (fcntl(kept[i], F_SETFD, 0) == ERROR) return false;
+  }
+  return true;
+}
 
-enum ExitCodes {
-  kError = -1,
-  kSuccess,
-  kInExecution,
-  kStopped,
-  kChildNotExist
-};
+// posix_spawn counterparts of RedirectInChild()/CloseRedirectedInChild()
+static void AddRedirection(posix_spawn_file_actions_t* file_actions,
+                           int fd, int target_fd) {
+  if (fd != NOT_EXIST && fd != target_fd)
+    posix_spawn_file_actions_adddup2(file_actions, fd, target_fd);
+}
 
-Subprocess::Subprocess(std::string command, std::string option, bool start) {
+#ifndef HAVE_SPAWN_CLOSEFROM
+static void AddCloseRedirected(posix_spawn_file_actions_t* file_actions,
+                               int fd) {
+  if (fd > STDERR_FILENO)
+    posix_spawn_file_actions_addclose(file_actions, fd);
+}
+#endif
+
+// close everything above stderr but status_fd and the ascending kept
+// fds in the child, async-signal-safe
+static void CloseInheritedInChild(int status_fd, const int* kept,
+                                  size_t kept_count) {
+#ifdef SYS_close_range
+  unsigned int low = STDERR_FILENO + 1;
+  size_t next_kept = 0;
+  bool status_kept = false;
+  while (!status_kept || next_kept < kept_count) {
+    // the gaps between the fds to keep, taken in ascending order
+    unsigned int keep;
+    if (!status_kept &&
+        (next_kept == kept_count || status_fd < kept[next_kept])) {
+      keep = status_fd;
+      status_kept = true;
+    } else {
+      keep = kept[next_kept++];
+    }
+    if (keep > low) syscall(SYS_close_range, low, keep - 1, 0);
+    if (keep >= low) low = keep + 1;
+  }
+  syscall(SYS_close_range, low, ~0U, 0);
+#endif
+}
+
+// a handler of the parent must not run on the shared memory of a CLONE_VM
+// child, so every caught signal goes back to its default action before
+// the mask the parent had at Start() is restored, as posix_spawn() does
+static void ResetSignalsInChild(const sigset_t* mask) {
+  struct sigaction action;
+  for (int signal_number = 1; signal_number < _NSIG; ++signal_number) {
+    // fails for the signals glibc reserves, those are left alone
+    if (sigaction(signal_number, nullptr, &action) == ERROR) continue;
+    if (action.sa_handler == SIG_IGN || action.sa_handler == SIG_DFL) {
+      continue;
+    }
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = 0;
+    sigaction(signal_number, &action, nullptr);
+  }
+  pthread_sigmask(SIG_SETMASK, mask, nullptr);
+}
+
+// hand errno to the parent through the exec status pipe, then exit
+static void ExitWithErrorInChild(int status_fd) {
+  int error = errno;
+  while (write(status_fd, &error, sizeof(error)) == ERROR &&
+         errno == EINTR) {
+  }
+  _exit(EXIT_FAILURE);
+}
+
+// errno written by a child whose exec failed, 0 on EOF as the write end
+// is close-on-exec and a successful exec closes it
+static int ReadExecStatus(int status_fd) {
+  int error = SUCCESS;
+  ssize_t size;
+  do {
+    size = read(status_fd, &error, sizeof(error));
+  } while (size == ERROR && errno == EINTR);
+  return size == sizeof(error) ? error : SUCCESS;
+}
+
+// pipe2() into a channel, both ends owned and close-on-exec
+static bool CreatePipe(ScopedFD* channel) {
+  int fd[FD_SIZE];
+  if (pipe2(fd, O_CLOEXEC) == ERROR) {
+    channel[FD_READ_END].Reset();
+    channel[FD_WRITE_END].Reset();
+    return false;
+  }
+  channel[FD_READ_END].Reset(fd[FD_READ_END]);
+  channel[FD_WRITE_END].Reset(fd[FD_WRITE_END]);
+  return true;
+}
+
+Subprocess::Subprocess(std::string command, std::string option, bool start,
+                       OptionSyntax syntax) {
 
   // parse the command passed by user
-  Subprocess::InitializeCommand(command, option);
+  Subprocess::InitializeCommand(command, option, syntax);
 
   if (start) Subprocess::CreateChildAndExecute();
 }
 
-void Subprocess::Start() {
+Subprocess::Subprocess(std::initializer_list<std::string> argv, bool start)
+    : argv_(argv.begin(), argv.end()) {
+  Subprocess::InitializeArgv();
+
+  if (start) Subprocess::CreateChildAndExecute();
+}
+
+int Subprocess::Start() {
   Subprocess::CreateChildAndExecute();
+  return spawn_error_;
+}
+
+void Subprocess::InitializeCommand(std::string cmd, std::string option,
+                                   OptionSyntax syntax) {
+  // split option into the argv arena in a single pass
+  if (syntax == kShellWords) {
+    argv_ = ArgvArena::FromShellWords(cmd, option);
+  } else {
+    argv_ = ArgvArena::FromCommandLine(cmd, option);
+  }
+  Subprocess::InitializeArgv();
 }
 
-void Subprocess::InitializeCommand(std::string cmd, std::string option) {
+void Subprocess::InitializeArgv() {
   // set path variable
-  if (cmd.find("/") != std::string::npos)
-    path_ = true;
-
-  // split and store cmd and option into vector_of_strings
-  v_command_.push_back(cmd);
-  bool condition = true;
-  int start_index = 0, next_index = 1;
-  if (!option.empty()) {
-    while (condition) {
-      int space_index = option.find(SPACE);
-
-      if (space_index != NOT_EXIST) {
-        std::string temp_str = option.substr(start_index, space_index);
-        option = option.substr(space_index + next_index);
-
-      if (temp_str.length())
-        v_command_.push_back(temp_str);
-      } else {
-        if (cmd.length())
-          v_command_.push_back(option);
-
-        break;
+  int executable_index = 0;
+  path_ = !argv_.empty() && strchr(argv_[executable_index], '/');
+}
+
+const char* Subprocess::ExecutablePath() const {
+  int executable_index = 0;
+  if (!resolved_path_.empty()) return resolved_path_.c_str();
+  return argv_[executable_index];
+}
+
+// Shared O_APPEND descriptor per output file of a batch
+static int OpenBatchFile(const std::string& filename,
+                         std::unordered_map<std::string, ScopedFD>* files) {
+  ScopedFD& fd = (*files)[filename];
+  if (!fd.valid()) {
+    int fd_write = open(filename.c_str(),
+                        O_APPEND | O_CREAT | O_WRONLY | O_CLOEXEC,
+                        READ_WRITE_PERMISSION);
+    if (fd_write == ERROR) {
+      int error = errno;
+      EFDLOG(SUBPROC) << "Error during open() on " << filename << ":\n"
+                      << strerror(error);
+      errno = error;
+      return ERROR;
+    }
+    fd.Reset(fd_write);
+  }
+  return fd.get();
+}
+
+// Own copy of a batch file still borrowed after a failed launch
+static void KeepBatchFile(ScopedFD* fd) {
+  if (!fd->valid() || fd->owned()) return;
+  int fd_copy = fcntl(fd->get(), F_DUPFD_CLOEXEC, 0);
+  if (fd_copy == ERROR) {
+    EFDLOG(SUBPROC) << "Error duplicating batch file:\n" << strerror(errno);
+  }
+  fd->Reset(fd_copy);
+}
+
+std::vector<Subprocess> Subprocess::SpawnBatch(
+    const std::vector<CommandSpec>& specs, int threads) {
+  bool start_execution = false;
+  std::vector<Subprocess> batch;
+  batch.reserve(specs.size());
+
+  // keyed by file name, shared by the whole batch
+  std::unordered_map<std::string, ScopedFD> files;
+  // commands whose files could not be opened, never started
+  std::vector<bool> failed(specs.size(), false);
+
+  // everything but the launches themselves happens up front
+  for (size_t i = 0; i < specs.size(); ++i) {
+    const CommandSpec& spec = specs[i];
+    if (spec.argv.empty()) {
+      batch.emplace_back(spec.command, spec.option, start_execution,
+                         spec.syntax);
+    } else {
+      batch.emplace_back(spec.argv.begin(), spec.argv.end(),
+                         start_execution);
+    }
+    Subprocess& process = batch.back();
+    process.SetLaunchBackend(spec.backend);
+    process.SetEnvironment(spec.environment);
+    if (!spec.working_dir.empty()) {
+      process.SetWorkingDirectory(spec.working_dir);
+    }
+
+    // a command not found is reported by its launch as usual
+    if (!process.argv_.empty()) process.ResolveExecutable();
+
+    // an input file is opened per child, they must not share the offset
+    if (!spec.input_file.empty()) {
+      process.ReceiveInputFromFile(spec.input_file);
+    }
+    if (!spec.output_file.empty()) {
+      int fd = OpenBatchFile(spec.output_file, &files);
+      if (fd == ERROR) {
+        process.spawn_error_ = errno;
+        failed[i] = true;
+        continue;
       }
+      process.SendOutputToFile(fd);
+      process.output_path_ = spec.output_file;
+    }
+    if (!spec.error_file.empty()) {
+      int fd = OpenBatchFile(spec.error_file, &files);
+      if (fd == ERROR) {
+        process.spawn_error_ = errno;
+        failed[i] = true;
+        continue;
+      }
+      process.SendErrorToFile(fd);
+      process.error_path_ = spec.error_file;
+    }
+  }
+
+  // workers take the next unstarted command until none is left
+  std::atomic<size_t> next(0);
+  auto launch = [&batch, &failed, &next]() {
+    for (size_t i = next++; i < batch.size(); i = next++) {
+      if (!failed[i]) batch[i].Start();
+    }
+  };
+  size_t workers = std::min(static_cast<size_t>(std::max(threads, 1)),
+                            batch.size());
+  std::vector<std::thread> helpers;
+  for (size_t i = 1; i < workers; ++i) helpers.emplace_back(launch);
+  launch();
+  for (std::thread& helper : helpers) helper.join();
+
+  // children have their copies of the shared files by now, a command
+  // that failed gets its own before they are closed with files
+  for (Subprocess& process : batch) {
+    if (process.child_pid_ != NOT_EXIST) continue;
+    KeepBatchFile(&process.output_fd_[FD_WRITE_END]);
+    KeepBatchFile(&process.error_fd_[FD_WRITE_END]);
+  }
+  return batch;
+}
+
+void Subprocess::SetLaunchBackend(LaunchBackend backend) {
+  backend_ = backend;
+}
+
+void Subprocess::SetEnvironment(
+    std::shared_ptr<const Environment> environment) {
+  environment_ = std::move(environment);
+}
+
+void Subprocess::SetWorkingDirectory(const std::string& directory) {
+  working_dir_ = directory;
+  working_dir_fd_ = NOT_EXIST;
+}
+
+void Subprocess::SetWorkingDirectory(int dirfd) {
+  working_dir_.clear();
+  working_dir_fd_ = dirfd;
+}
+
+char** Subprocess::ChildEnvironment() const {
+  return environment_ ? environment_->envp() : environ;
+}
+
+void Subprocess::InheritFD(int fd) {
+  if (fd <= STDERR_FILENO) {
+    EFDLOG(SUBPROC) << "Invalid inherited fd " << fd
+                    << ":\nuse the input/output/error channels";
+    return;
+  }
+  // kept sorted for CloseInheritedInChild()
+  auto it = std::lower_bound(inherited_fds_.begin(), inherited_fds_.end(),
+                             fd);
+  if (it == inherited_fds_.end() || *it != fd) inherited_fds_.insert(it, fd);
+}
+
+void Subprocess::SetProcessGroup(ProcessGroupMode mode) {
+  group_mode_ = mode;
+}
+
+void Subprocess::UseChildRegistry() {
+  use_registry_ = true;
+}
+
+void Subprocess::SetResourceLimit(int resource, rlim_t soft_limit,
+                                  rlim_t hard_limit) {
+  struct rlimit limit;
+  limit.rlim_cur = soft_limit;
+  limit.rlim_max = hard_limit;
+  resources_.limits.push_back(std::make_pair(resource, limit));
+}
+
+void Subprocess::SetCpuAffinity(const cpu_set_t& cpus) {
+  resources_.affinity = cpus;
+  resources_.set_affinity = true;
+}
+
+void Subprocess::SetNice(int nice) {
+  resources_.nice = nice;
+  resources_.set_nice = true;
+}
+
+void Subprocess::SetIoPriority(IoPriorityClass io_class, int level) {
+  resources_.io_priority = io_class << IOPRIO_CLASS_SHIFT | level;
+}
+
+bool Subprocess::SetCgroup(const std::string& cgroup_dir) {
+  int fd = open(cgroup_dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd == ERROR) {
+    EFDLOG(SUBPROC) << "Error during open() on cgroup " << cgroup_dir
+                    << ":\n" << strerror(errno);
+    return false;
+  }
+  resources_.cgroup_fd.Reset(fd);
+  return true;
+}
+
+// Read a small cgroup interface file, empty if it does not exist
+static std::string ReadCgroupFile(int cgroup_fd, const char* name) {
+  std::string content;
+  int fd = openat(cgroup_fd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == ERROR) return content;
+  char buffer[CGROUP_STAT_SIZE];
+  ssize_t size;
+  while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, size);
+  }
+  close(fd);
+  return content;
+}
+
+// value of key in a flat keyed file such as cpu.stat, 0 if missing
+static uint64_t CgroupStatValue(const std::string& content,
+                                const std::string& key) {
+  size_t position = 0;
+  while ((position = content.find(key, position)) != std::string::npos) {
+    bool line_start = position == 0 || content[position - 1] == '\n';
+    position += key.size();
+    if (line_start && position < content.size() &&
+        content[position] == ' ') {
+      return strtoull(content.c_str() + position + 1, nullptr, 10);
     }
   }
-  Subprocess::ConvertToChar();
+  return 0;
 }
 
-void Subprocess::ConvertToChar() {
-  // convert vector_of_string to vector_of_char*
-  for (auto it = v_command_.begin(); it != v_command_.end(); it++) {
-     ch_command_.push_back(const_cast<char*>((*it).c_str()));
+bool Subprocess::GetCgroupUsage(CgroupUsage* usage) {
+  if (!resources_.cgroup_fd.valid()) return false;
+  int cgroup_fd = resources_.cgroup_fd.get();
+
+  // O_PATH descriptors can be used as the directory of openat()
+  std::string cpu_stat = ReadCgroupFile(cgroup_fd, "cpu.stat");
+  if (cpu_stat.empty()) {
+    EFDLOG(SUBPROC) << "Error reading cpu.stat of cgroup:\n"
+                    << strerror(errno);
+    return false;
   }
-  ch_command_.push_back(nullptr);
+  usage->cpu_usec = CgroupStatValue(cpu_stat, "usage_usec");
+  usage->user_usec = CgroupStatValue(cpu_stat, "user_usec");
+  usage->system_usec = CgroupStatValue(cpu_stat, "system_usec");
+  // memory.peak needs the memory controller and Linux 5.19
+  usage->memory_peak = strtoull(
+      ReadCgroupFile(cgroup_fd, "memory.peak").c_str(), nullptr, 10);
+  return true;
+}
+
+bool Subprocess::ResolveExecutable() {
+  if (path_ || !resolved_path_.empty()) return true;
+  // exec*p() would search the PATH of this process, not the one given
+  const char* search_path =
+      environment_ ? environment_->Get("PATH") : nullptr;
+  ExecutableCache& cache = ExecutableCache::Instance();
+  if (!cache.IsEnabled() && !search_path) return true;
+
+  // found in the parent, the child execs it without searching PATH
+  int error = SUCCESS;
+  if (!search_path) search_path = getenv("PATH");
+  resolved_path_ = cache.Resolve(ExecutablePath(), search_path, &error);
+  spawn_error_ = error;
+  return error == SUCCESS;
 }
 
 void Subprocess::CreateChildAndExecute() {
+  start_time_ = std::chrono::steady_clock::now();
+  bool traced = SubprocessTrace::Enabled();
+  if (traced) {
+    SubprocessTrace::Emit(kTraceSpawnStart, NOT_EXIST, NOT_EXIST, 0,
+                          start_time_);
+  }
+
+  pid_t pid = LaunchChild();
+
+  if (traced) {
+    if (pid != ERROR) {
+      SubprocessTrace::Emit(kTraceExec, pid, NOT_EXIST,
+                            SubprocessTrace::Nanoseconds(start_time_,
+                                                         exec_time_),
+                            exec_time_);
+    }
+    SubprocessTrace::Emit(kTraceSpawnEnd, pid, NOT_EXIST, spawn_error_);
+  }
+}
+
+pid_t Subprocess::LaunchChild() {
+  pid_t pid = ERROR;
+  spawn_error_ = SUCCESS;
+  if (argv_.empty()) {
+    EFDLOG(SUBPROC) << "Child creation Failed:\nempty argv";
+    spawn_error_ = EINVAL;
+    return ERROR;
+  }
+  if (!ResolveExecutable()) {
+    EFDLOG(SUBPROC) << "Child creation Failed:\n" << ExecutablePath()
+                    << ": " << strerror(spawn_error_);
+    return ERROR;
+  }
+
+  // settings the child applies itself need a child running our code
+  LaunchBackend backend = backend_;
+  if ((!resources_.empty() || !inherited_fds_.empty()) &&
+      (backend != kVfork || resources_.cgroup_fd.valid())) {
+    backend = kClone3;
+  }
+  // only the clone backend can create a child without exit signal
+  if (use_registry_) backend = kClone3;
+  // the spawn server only sets the stdio, environment and directory of
+  // the caller on its children
+  bool working_dir = !working_dir_.empty() || working_dir_fd_ != NOT_EXIST;
+  if (backend == kSpawnServer &&
+      (group_mode_ != kInheritGroup || working_dir)) {
+    backend = kPosixSpawn;
+  }
+#ifndef HAVE_SPAWN_CHDIR
+  if (working_dir && backend == kPosixSpawn) backend = kClone3;
+#endif
+#ifndef HAVE_SPAWN_SETSID
+  if (group_mode_ == kNewSession && backend == kPosixSpawn) {
+    backend = kClone3;
+  }
+#endif
+
+  exit_slot_.reset();
+  reaped_ = false;
+  launch_time_ = std::chrono::steady_clock::now();
+  switch (backend) {
+    case kPosixSpawn:
+      pid = SpawnWithPosixSpawn();
+      break;
+    case kClone3:
+      pid = SpawnWithClone3();
+      break;
+    case kVfork:
+      pid = SpawnWithVfork();
+      break;
+    case kSpawnServer:
+      pid = SpawnWithServer();
+      break;
+  }
+
+  // every backend returns once the child has exec'd
+  exec_time_ = std::chrono::steady_clock::now();
+  if (pid != ERROR) {
+    child_pid_ = pid;
+    OpenPidFD();
+    CloseChildFDsInParent();
+    if (use_registry_ && pidfd_.valid()) {
+      // the slot owns the pidfd from now on, ours is only borrowed
+      exit_slot_ = ChildRegistry::Instance().Register(pid, &pidfd_);
+      if (exit_slot_) pidfd_.Borrow(exit_slot_->pidfd());
+    }
+  }
+  return pid;
+}
+
+pid_t Subprocess::SpawnWithPosixSpawn() {
+  /*
+   * posix_spawn() - creates the child and executes the command in one call
+   * The file actions below replay in the child what ExecuteProcess() does
+   * for the vfork/clone3 backends, so nothing runs in a shared address
+   * space under our control.
+   * Returns 0 on success, otherwise the error number
+   */
+  posix_spawn_file_actions_t file_actions;
+  int ret = posix_spawn_file_actions_init(&file_actions);
+  if (ret != SUCCESS) {
+    EFDLOG(SUBPROC) << "Error during posix_spawn_file_actions_init():\n"
+                    << strerror(ret);
+    return ERROR;
+  }
+
+  // Set Subprocess FDs as stdin, stdout and stderr
+  AddRedirection(&file_actions, input_fd_[FD_READ_END].get(), STDIN_FILENO);
+  AddRedirection(&file_actions, output_fd_[FD_WRITE_END].get(),
+                 STDOUT_FILENO);
+  AddRedirection(&file_actions, error_fd_[FD_WRITE_END].get(),
+                 STDERR_FILENO);
+
+#ifdef HAVE_SPAWN_CHDIR
+  // before closefrom, which would close the directory descriptor
+  if (!working_dir_.empty()) {
+    posix_spawn_file_actions_addchdir_np(&file_actions,
+                                         working_dir_.c_str());
+  } else if (working_dir_fd_ != NOT_EXIST) {
+    posix_spawn_file_actions_addfchdir_np(&file_actions, working_dir_fd_);
+  }
+#endif
+
+  // Only stdin, stdout and stderr survive into the child
+#ifdef HAVE_SPAWN_CLOSEFROM
+  posix_spawn_file_actions_addclosefrom_np(&file_actions, STDERR_FILENO + 1);
+#else
+  // parent ends are close-on-exec, borrowed originals are closed here
+  AddCloseRedirected(&file_actions, input_fd_[FD_READ_END].get());
+  AddCloseRedirected(&file_actions, output_fd_[FD_WRITE_END].get());
+  AddCloseRedirected(&file_actions, error_fd_[FD_WRITE_END].get());
+#endif
+
+  // attributes are only set up when a new group or session is asked for
+  posix_spawnattr_t attributes;
+  posix_spawnattr_t* spawn_attributes = nullptr;
+  if (group_mode_ != kInheritGroup) {
+    spawn_attributes = &attributes;
+    posix_spawnattr_init(spawn_attributes);
+#ifdef HAVE_SPAWN_SETSID
+    if (group_mode_ == kNewSession) {
+      posix_spawnattr_setflags(spawn_attributes, POSIX_SPAWN_SETSID);
+    }
+#endif
+    if (group_mode_ == kNewProcessGroup) {
+      posix_spawnattr_setflags(spawn_attributes, POSIX_SPAWN_SETPGROUP);
+      posix_spawnattr_setpgroup(spawn_attributes, 0);
+    }
+  }
+
+  pid_t pid;
+  if (path_ || !resolved_path_.empty()) {
+    ret = posix_spawn(&pid, ExecutablePath(), &file_actions,
+                      spawn_attributes, argv_.data(), ChildEnvironment());
+  } else {
+    ret = posix_spawnp(&pid, ExecutablePath(), &file_actions,
+                       spawn_attributes, argv_.data(), ChildEnvironment());
+  }
+  posix_spawn_file_actions_destroy(&file_actions);
+  if (spawn_attributes) posix_spawnattr_destroy(spawn_attributes);
+
+  if (ret != SUCCESS) {
+    EFDLOG(SUBPROC) << "Error during posix_spawn():\n" << strerror(ret);
+    spawn_error_ = ret;
+    return ERROR;
+  }
+  return pid;
+}
+
+pid_t Subprocess::SpawnWithClone3() {
+  // only clone3() can create the child inside the cgroup
+  if (resources_.cgroup_fd.valid()) return SpawnIntoCgroup();
+
   /*
-   * fork() - creates a new process
-   * The value returned by fork() corresponds to:
+   * clone(CLONE_VM | CLONE_VFORK) shares the address space like vfork(),
+   * so no page tables are copied whatever the parent RSS, but runs the
+   * child on a stack of its own as posix_spawn() does. CLONE_PIDFD
+   * hands back a pidfd referring to the child (ignored before 5.2, the
+   * pidfd is then opened after the spawn). All signals stay blocked from
+   * before the clone until the child has reset the handlers, so none of
+   * the parent handlers can run in the child.
+   */
+  ScopedFD status[FD_SIZE];
+  if (!CreatePipe(status)) {
+    spawn_error_ = errno;
+    EFDLOG(SUBPROC) << "PIPE creation failed on exec status:\n"
+                    << strerror(errno);
+    return ERROR;
+  }
+
+  // execvpe() copies argv onto the stack to run scripts through /bin/sh
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t stack_size = CHILD_STACK_SIZE + argv_.size() * sizeof(char*);
+  stack_size = (stack_size + page_size - 1) / page_size * page_size;
+  void* stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE,
+                     NOT_EXIST, 0);
+  if (stack == MAP_FAILED) {
+    spawn_error_ = errno;
+    EFDLOG(SUBPROC) << "Error allocating the child stack:\n"
+                    << strerror(errno);
+    return ERROR;
+  }
+
+  sigset_t all_signals;
+  sigset_t old_mask;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+  struct CloneArgs {
+    Subprocess* process;
+    int status_fd;
+    const sigset_t* mask;
+  } clone_args = {this, status[FD_WRITE_END].get(), &old_mask};
+  auto child_main = [](void* arg) -> int {
+    CloneArgs* args = static_cast<CloneArgs*>(arg);
+    ResetSignalsInChild(args->mask);
+    args->process->ExecuteProcess(args->status_fd);
+    return ERROR;
+  };
+
+  // without exit signal the child is only seen by waits given __WALL
+  int flags = CLONE_VM | CLONE_VFORK | CLONE_PIDFD |
+              (use_registry_ ? 0 : SIGCHLD);
+  int pidfd = NOT_EXIST;
+  // the parent runs again once the child has exec'd or exited
+  pid_t pid = clone(child_main, static_cast<char*>(stack) + stack_size, flags,
+                    &clone_args, &pidfd);
+  int error = errno;
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  munmap(stack, stack_size);
+  if (pid == ERROR) {
+    spawn_error_ = error;
+    EFDLOG(SUBPROC) << "Child creation Failed:\n" << strerror(error);
+    return ERROR;
+  }
+
+  ScopedFD child_pidfd;
+  child_pidfd.Reset(pidfd);
+  if (!ExecSucceeded(pid, status)) return ERROR;
+  pidfd_ = std::move(child_pidfd);
+  return pid;
+}
+
+pid_t Subprocess::SpawnIntoCgroup() {
+#ifdef SYS_clone3
+  /*
+   * clone3() without CLONE_VM gives the child its own copy of the address
+   * space, so unlike the other backends its cost still grows with the
+   * parent RSS. The raw syscall returns into the child on the stack of
+   * the parent, which it must therefore not share. CLONE_VFORK only
+   * suspends the parent until exec.
+   */
+  ScopedFD status[FD_SIZE];
+  if (!CreatePipe(status)) {
+    spawn_error_ = errno;
+    EFDLOG(SUBPROC) << "PIPE creation failed on exec status:\n"
+                    << strerror(errno);
+    return ERROR;
+  }
+
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  int pidfd = NOT_EXIST;
+  args.flags = CLONE_VFORK | CLONE_PIDFD | CLONE_INTO_CGROUP;
+  args.pidfd = reinterpret_cast<uint64_t>(&pidfd);
+  args.exit_signal = use_registry_ ? 0 : SIGCHLD;
+  args.cgroup = resources_.cgroup_fd.get();
+
+  long pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == SUCCESS) {
+    ExecuteProcess(status[FD_WRITE_END].get());
+  } else if (pid == ERROR) {
+    spawn_error_ = errno;
+    EFDLOG(SUBPROC) << "Child creation Failed:\n" << strerror(errno);
+    return ERROR;
+  }
+  ScopedFD child_pidfd;
+  child_pidfd.Reset(pidfd);
+  if (!ExecSucceeded(pid, status)) return ERROR;
+  pidfd_ = std::move(child_pidfd);
+  return pid;
+#else
+  spawn_error_ = ENOSYS;
+  EFDLOG(SUBPROC) << "Child creation Failed:\nno clone3() for the cgroup";
+  return ERROR;
+#endif
+}
+
+pid_t Subprocess::SpawnWithVfork() {
+  /*
+   * vfork() - creates a new process sharing the parent address space
+   * The value returned by vfork() corresponds to:
    * 0: if it is the child process (the process created).
    * Positive value: if it is the parent process.
    * -1: if an error occurred.
-   * change fork to vfork, otherwise it will conflict with
+   * fork is avoided, otherwise it will conflict with
    * libopenblasp-r0-085ca80a.3.9.so in scipy @ronghua.zhou
    */
+  ScopedFD status[FD_SIZE];
+  if (!CreatePipe(status)) {
+    spawn_error_ = errno;
+    EFDLOG(SUBPROC) << "PIPE creation failed on exec status:\n"
+                    << strerror(errno);
+    return ERROR;
+  }
+
   int is_child_process = 0;
-  int pid = vfork();
+  pid_t pid = vfork();
 
   if (pid == ERROR) {
+    spawn_error_ = errno;
     EFDLOG(SUBPROC) << "Child creation Failed:\n" << strerror(errno);
   } else if (pid == is_child_process) {
-    // Closing Parent FDs in Child
-    if (input_fd_[FD_WRITE_END] != NOT_EXIST &&
-      close(input_fd_[FD_WRITE_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error closing input FD in Child Process:\n"
-                      << strerror(errno);
-    }
+    ExecuteProcess(status[FD_WRITE_END].get());
+  } else if (!ExecSucceeded(pid, status)) {
+    return ERROR;
+  }
+  return pid;
+}
 
-    if (output_fd_[FD_READ_END] != NOT_EXIST &&
-        close(output_fd_[FD_READ_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error closing output FD in Child Process:\n"
-                      << strerror(errno);
-    }
+bool Subprocess::ExecSucceeded(pid_t pid, ScopedFD* status) {
+  // the parent runs again once the child has exec'd or exited
+  status[FD_WRITE_END].Reset();
+  int error = ReadExecStatus(status[FD_READ_END].get());
+  if (error == SUCCESS) return true;
 
-    if (error_fd_[FD_READ_END] != NOT_EXIST &&
-        close(error_fd_[FD_READ_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error Closing error FD in Child Process:\n"
-                      << strerror(errno);
-    }
+  // the child has exited already, reap it rather than leave a zombie
+  waitpid(pid, nullptr, __WALL);
+  spawn_error_ = error;
+  EFDLOG(SUBPROC) << "Error during exec() of " << ExecutablePath() << ":\n"
+                  << strerror(error);
+  return false;
+}
 
-    child_pid_ = getpid();
-    ExecuteProcess();
-  } else if (pid > is_child_process) {
-    child_pid_ = pid;
+pid_t Subprocess::SpawnWithServer() {
+  int stdio[] = {
+    input_fd_[FD_READ_END].valid() ? input_fd_[FD_READ_END].get()
+                                   : STDIN_FILENO,
+    output_fd_[FD_WRITE_END].valid() ? output_fd_[FD_WRITE_END].get()
+                                     : STDOUT_FILENO,
+    error_fd_[FD_WRITE_END].valid() ? error_fd_[FD_WRITE_END].get()
+                                    : STDERR_FILENO
+  };
 
-    // Closing Child FDs in Parent
-    if (input_fd_[FD_READ_END] != NOT_EXIST &&
-        close(input_fd_[FD_READ_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error closing input FD in Parent Process:\n"
+  int pidfd = NOT_EXIST;
+  int exec_error = SUCCESS;
+  pid_t pid = SpawnServer::Instance().Spawn(ExecutablePath(), argv_.data(),
+                                            ChildEnvironment(), path_, stdio,
+                                            &pidfd, &exec_error);
+  if (pid == ERROR && exec_error != SUCCESS) {
+    // exec failed or the command may have run, never launch it twice
+    spawn_error_ = exec_error;
+    EFDLOG(SUBPROC) << "Error during spawn server launch of "
+                    << ExecutablePath() << ":\n" << strerror(exec_error);
+    return ERROR;
+  }
+  if (pid == ERROR) {
+    // server not started or nothing launched, launch directly
+    if (errno != ENOTCONN) {
+      EFDLOG(SUBPROC) << "Error during spawn server launch:\n"
                       << strerror(errno);
     }
+    return SpawnWithPosixSpawn();
+  }
+  pidfd_.Reset(pidfd);
+  return pid;
+}
 
-    if (output_fd_[FD_WRITE_END] != NOT_EXIST &&
-        close(output_fd_[FD_WRITE_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error closing output FD in Parent Process:\n"
-                      << strerror(errno);
-    }
+void Subprocess::CloseChildFDsInParent() {
+  // the child has its copies, borrowed descriptors stay open for the caller
+  input_fd_[FD_READ_END].Reset();
+  output_fd_[FD_WRITE_END].Reset();
+  error_fd_[FD_WRITE_END].Reset();
+}
 
-    if (error_fd_[FD_WRITE_END] != NOT_EXIST &&
-        close(error_fd_[FD_WRITE_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error closing error FD in Parent Process:\n"
-                      << strerror(errno);
-    }
-  }
+void Subprocess::ClosePidFD() {
+  pidfd_.Reset();
 }
 
-void Subprocess::ExecuteProcess() {
-  // Set Subprocess FDs as stdin, stdout and stderr
-  if (input_fd_[FD_READ_END] != NOT_EXIST) {
-    if (dup2(input_fd_[FD_READ_END], STDIN_FILENO) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during dup2 input FD:\n" << strerror(errno);
-    } else if (close(input_fd_[FD_READ_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during closing dup2 input FD:\n"
-                      << strerror(errno);
-    }
-  }
+void Subprocess::ExecuteProcess(int status_fd) {
+  /*
+   * Runs in the vfork/clone3 child. Under vfork the parent memory is
+   * shared, so nothing here may log, allocate or write to members.
+   * Failures are reported to the parent through status_fd.
+   */
 
-  if (output_fd_[FD_WRITE_END] != NOT_EXIST) {
-    if (dup2(output_fd_[FD_WRITE_END], STDOUT_FILENO) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during dup2 output FD:\n" << strerror(errno);
-    } else if (close(output_fd_[FD_WRITE_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during closing dup2 output FD:\n"
-                      << strerror(errno);
-    }
+  // Set Subprocess FDs as stdin, stdout and stderr
+  int input_fd = input_fd_[FD_READ_END].get();
+  int output_fd = output_fd_[FD_WRITE_END].get();
+  int error_fd = error_fd_[FD_WRITE_END].get();
+  const int* kept = inherited_fds_.data();
+  size_t kept_count = inherited_fds_.size();
+  if (!RedirectInChild(input_fd, STDIN_FILENO) ||
+      !RedirectInChild(output_fd, STDOUT_FILENO) ||
+      !RedirectInChild(error_fd, STDERR_FILENO) ||
+      !JoinProcessGroupInChild(group_mode_) || !ApplyResourcesInChild() ||
+      !ChangeDirectoryInChild() ||
+      !ClearCloseOnExecInChild(kept, kept_count)) {
+    ExitWithErrorInChild(status_fd);
   }
 
-  if (error_fd_[FD_WRITE_END] != NOT_EXIST) {
-    if (dup2(error_fd_[FD_WRITE_END], STDERR_FILENO) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during dup2 error FD:\n" << strerror(errno);
-    } else if (close(error_fd_[FD_WRITE_END]) == ERROR) {
-      EFDLOG(SUBPROC) << "Error during closing dup2 error FD:\n"
-                      << strerror(errno);
-    }
-  }
+  // Only stdin, stdout and stderr survive, without close_range() (before
+  // 5.9) the parent ends are still close-on-exec
+  CloseRedirectedInChild(input_fd, kept, kept_count);
+  CloseRedirectedInChild(output_fd, kept, kept_count);
+  CloseRedirectedInChild(error_fd, kept, kept_count);
+  CloseInheritedInChild(status_fd, kept, kept_count);
 
   /*
-   * execvp() - replaces the current process image with a new process image
+   * execvpe() - replaces the current process image with a new process image
    * arguments - The initial argument is the name of a file that is to be
-   *             executed.
-   * Return -1, only when an error has occured 
+   *             executed, the last one the environment it gets.
+   * Return -1, only when an error has occured
    */
-  int executable_index = 0;
-  if(!path_ &&
-     execvp(ch_command_[executable_index], ch_command_.data()) == ERROR) {
-    EFDLOG(SUBPROC) << "Error during execvp():\n" << strerror(errno);
-    _exit(EXIT_FAILURE);
-  } else if(execv(ch_command_[executable_index], ch_command_.data()) == ERROR) {
-    EFDLOG(SUBPROC) << "Error during execvp():\n" << strerror(errno);
-    _exit(EXIT_FAILURE);
+  if (path_) {
+    execve(ExecutablePath(), argv_.data(), ChildEnvironment());
+  } else {
+    // a name resolved in the parent has a '/' now, execvpe() then skips
+    // the PATH search but still runs a file without #! through /bin/sh
+    execvpe(ExecutablePath(), argv_.data(), ChildEnvironment());
   }
+  ExitWithErrorInChild(status_fd);
 }
 
+bool Subprocess::ChangeDirectoryInChild() {
+  if (!working_dir_.empty()) return chdir(working_dir_.c_str()) != ERROR;
+  if (working_dir_fd_ != NOT_EXIST) return fchdir(working_dir_fd_) != ERROR;
+  return true;
+}
+
+bool Subprocess::ApplyResourcesInChild() {
+  for (const auto& limit : resources_.limits) {
+    if (setrlimit(limit.first, &limit.second) == ERROR) return false;
+  }
+  if (resources_.set_affinity &&
+      sched_setaffinity(0, sizeof(resources_.affinity),
+                        &resources_.affinity) == ERROR) {
+    return false;
+  }
+  if (resources_.set_nice &&
+      setpriority(PRIO_PROCESS, 0, resources_.nice) == ERROR) {
+    return false;
+  }
+  if (resources_.io_priority != NOT_EXIST &&
+      syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+              resources_.io_priority) == ERROR) {
+    return false;
+  }
+  return true;
+}
 
 int Subprocess::SubprocessWait() {
   int process_status;
@@ -200,20 +954,31 @@ int Subprocess::SubprocessWait() {
   // combination of WNOHANG, WUNTRACED, WCONTINUED 
   int flag = 0;
 
-  if (kill(child_pid_, SIGNAL) == NOT_EXIST) {
+  // posix_spawn() reports exec failures without leaving a child behind,
+  // once reaped the pid may belong to another process already
+  if (child_pid_ == NOT_EXIST || reaped_) {
     return kError;
   }
 
   /* 
-   * waitpid() - wait for process to change state
+   * ReapChild() - wait for process to change state, as waitpid()
    * Returns
    *  -1 - when error occurs
    *   0 - when WNOHANG is set, and no child process has changed its state
    *   process-pid of child whose state has changes - when successful
    */
-  pid = waitpid(child_pid_, &process_status, flag);
+  pid = ReapChild(flag, &process_status, nullptr);
+  if (pid != ERROR && SubprocessTrace::Enabled()) {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    SubprocessTrace::Emit(kTraceExit, pid, NOT_EXIST,
+                          SubprocessTrace::Nanoseconds(exec_time_, now), now);
+    SubprocessTrace::Emit(kTraceReap, pid, NOT_EXIST, process_status, now);
+  }
   if (pid == ERROR) {
-    EFCHECK(false) << "Error during waitpid():\n" << strerror(errno);
+    // e.g. reaped by a waitpid(-1) elsewhere in the process
+    EFDLOG(SUBPROC) << "Error during waitpid():\n" << strerror(errno);
+    return kError;
   } else {
     if (WIFEXITED(process_status)) {
       EFDLOG(SUBPROC) << "The process ended with status: "
@@ -230,14 +995,82 @@ int Subprocess::SubprocessWait() {
   return pid;
 }
 
+ExitInfo Subprocess::WaitForExit() {
+  ExitInfo info;
+  if (child_pid_ == NOT_EXIST) {
+    info.error = ECHILD;
+    return info;
+  }
+
+  // the pidfd tells the exit apart from the reaping, the registry already
+  // noted when it saw the exit
+  bool has_pidfd = pidfd_.valid() && !exit_slot_;
+  if (has_pidfd) {
+    struct pollfd poll_fd;
+    poll_fd.fd = pidfd_.get();
+    poll_fd.events = POLLIN;
+    while (poll(&poll_fd, 1, -1) == ERROR && errno == EINTR) {
+    }
+  }
+  std::chrono::steady_clock::time_point exit_time =
+      std::chrono::steady_clock::now();
+
+  struct rusage usage;
+  pid_t pid = ReapChild(0, &info.wait_status, &usage);
+  std::chrono::steady_clock::time_point reap_time =
+      std::chrono::steady_clock::now();
+  if (pid == ERROR) {
+    info.error = errno;
+    return info;
+  }
+  if (exit_slot_) {
+    exit_time = exit_slot_->exit_time();
+  } else if (!has_pidfd) {
+    exit_time = reap_time;
+  }
+
+  info.pid = pid;
+  if (WIFEXITED(info.wait_status)) {
+    info.exit_code = WEXITSTATUS(info.wait_status);
+  } else if (WIFSIGNALED(info.wait_status)) {
+    info.signal = WTERMSIG(info.wait_status);
+    info.core_dumped = WCOREDUMP(info.wait_status);
+  }
+
+  info.user_time = std::chrono::seconds(usage.ru_utime.tv_sec) +
+                   std::chrono::microseconds(usage.ru_utime.tv_usec);
+  info.system_time = std::chrono::seconds(usage.ru_stime.tv_sec) +
+                     std::chrono::microseconds(usage.ru_stime.tv_usec);
+  info.max_rss_kb = usage.ru_maxrss;
+  info.minor_faults = usage.ru_minflt;
+  info.major_faults = usage.ru_majflt;
+  info.voluntary_switches = usage.ru_nvcsw;
+  info.involuntary_switches = usage.ru_nivcsw;
+
+  info.spawn_time = launch_time_ - start_time_;
+  info.exec_time = exec_time_ - launch_time_;
+  info.run_time = exit_time - exec_time_;
+  info.reap_time = reap_time - exit_time;
+
+  if (SubprocessTrace::Enabled()) {
+    SubprocessTrace::Emit(kTraceExit, pid, NOT_EXIST,
+                          SubprocessTrace::Nanoseconds(exec_time_, exit_time),
+                          exit_time);
+    SubprocessTrace::Emit(kTraceReap, pid, NOT_EXIST, info.wait_status,
+                          reap_time);
+  }
+  return info;
+}
+
 // Input Channel
 void Subprocess::ReceiveInputFromFile(std::string filename) {
-  int fd_read = open(filename.c_str(), O_RDONLY);
+  int fd_read = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
   if (fd_read == ERROR) {
     EFDLOG(SUBPROC) << "Error during open() on Input:\n" << strerror(errno);
   } else {
-    input_fd_[FD_READ_END] = fd_read;
+    input_fd_[FD_READ_END].Reset(fd_read);
   }
+  input_fd_[FD_WRITE_END].Reset();
 }
 
 void Subprocess::ReceiveInputFromFile(FILE* fp) {
@@ -245,29 +1078,37 @@ void Subprocess::ReceiveInputFromFile(FILE* fp) {
   if (fd == ERROR) {
     EFDLOG(SUBPROC) << "Error during fileno() on Input:\n" << strerror(errno);
   } else {
-    input_fd_[FD_READ_END] = fd;
+    ReceiveInputFromFile(fd);
   }
 }
 
 void Subprocess::ReceiveInputFromFile(int fd) {
-  input_fd_[FD_READ_END] = fd;
+  input_fd_[FD_READ_END].Borrow(fd);
+  input_fd_[FD_WRITE_END].Reset();
+}
+
+void Subprocess::ReceiveInputFromPipe() {
+  if (!CreatePipe(input_fd_)) {
+    EFDLOG(SUBPROC) << "PIPE creation failed on Input:\n" << strerror(errno);
+  }
+}
+
+void Subprocess::CloseInput() {
+  input_fd_[FD_WRITE_END].Reset();
 }
 
 // Output Channel
 void Subprocess::SendOutputToFile(std::string filename) {
   int fd_write = open(filename.c_str(),
-                      O_APPEND | O_CREAT | O_WRONLY, READ_WRITE_PERMISSION);
+                      O_APPEND | O_CREAT | O_WRONLY | O_CLOEXEC,
+                      READ_WRITE_PERMISSION);
   if (fd_write == ERROR) {
     EFDLOG(SUBPROC) << "Error during open() on Output:\n" << strerror(errno);
   } else {
-    output_fd_[FD_WRITE_END] = fd_write;
-  }
-  int fd_read = open(filename.c_str(), O_RDONLY);
-  if (fd_read == ERROR) {
-    EFDLOG(SUBPROC) << "Error during open() on Output:\n" << strerror(errno);
-  } else {
-    output_fd_[FD_READ_END] = fd_read;
+    output_fd_[FD_WRITE_END].Reset(fd_write);
   }
+  output_fd_[FD_READ_END].Reset();
+  output_path_ = filename;
 }
 
 void Subprocess::SendOutputToFile(FILE* fp) {
@@ -277,38 +1118,46 @@ void Subprocess::SendOutputToFile(FILE* fp) {
       EFDLOG(SUBPROC) << "Error during fileno() on Output:\n"
                       << strerror(errno);
     } else {
-      output_fd_[FD_WRITE_END] = fd;
+      SendOutputToFile(fd);
     }
   } else {
-    int fd_null =  open(DEV_NULL, O_WRONLY);
+    int fd_null =  open(DEV_NULL, O_WRONLY | O_CLOEXEC);
     if (fd_null == ERROR) {
       EFDLOG(SUBPROC) << "Error during open() on /dev/null for Output:\n"
                       << strerror(errno);
     } else {
-      output_fd_[FD_WRITE_END] = fd_null;
+      output_fd_[FD_WRITE_END].Reset(fd_null);
+      output_fd_[FD_READ_END].Reset();
+      output_path_.clear();
     }
   }
 }
 
 void Subprocess::SendOutputToFile(int fd) {
-  output_fd_[FD_WRITE_END] = fd;
+  output_fd_[FD_WRITE_END].Borrow(fd);
+  output_fd_[FD_READ_END].Reset();
+  output_path_.clear();
+}
+
+void Subprocess::SendOutputToPipe() {
+  if (!CreatePipe(output_fd_)) {
+    EFDLOG(SUBPROC) << "PIPE creation failed on Output:\n" << strerror(errno);
+  }
+  output_path_.clear();
 }
 
 // Error Channel
 void Subprocess::SendErrorToFile(std::string filename) {
   int fd_write = open(filename.c_str(),
-                O_APPEND | O_CREAT | O_WRONLY, READ_WRITE_PERMISSION);
+                      O_APPEND | O_CREAT | O_WRONLY | O_CLOEXEC,
+                      READ_WRITE_PERMISSION);
   if (fd_write == ERROR) {
     EFDLOG(SUBPROC) << "Error during open() on Error:\n" << strerror(errno);
   } else {
-    error_fd_[FD_WRITE_END] = fd_write;
-  }
-  int fd_read = open(filename.c_str(), O_RDONLY);
-  if (fd_read == ERROR) {
-    EFDLOG(SUBPROC) << "Error during open() on Error:\n" << strerror(errno);
-  } else {
-    error_fd_[FD_READ_END] = fd_read;
+    error_fd_[FD_WRITE_END].Reset(fd_write);
   }
+  error_fd_[FD_READ_END].Reset();
+  error_path_ = filename;
 }
 
 void Subprocess::SendErrorToFile(FILE* fp) {
@@ -317,55 +1166,261 @@ void Subprocess::SendErrorToFile(FILE* fp) {
     if (fd == ERROR) {
       EFDLOG(SUBPROC) << "Error during fileno() on Error:\n" << strerror(errno);
     } else {
-      error_fd_[FD_WRITE_END] = fd;
+      SendErrorToFile(fd);
     }
   } else {
-    int fd_null = open(DEV_NULL, O_WRONLY);
+    int fd_null = open(DEV_NULL, O_WRONLY | O_CLOEXEC);
     if (fd_null == ERROR) {
       EFDLOG(SUBPROC) << "Error during open() on /dev/null for Error:\n"
                       << strerror(errno);
     } else {
-      error_fd_[FD_WRITE_END] = fd_null;
+      error_fd_[FD_WRITE_END].Reset(fd_null);
+      error_fd_[FD_READ_END].Reset();
+      error_path_.clear();
     }
   }
 }
 
 void Subprocess::SendErrorToFile(int fd) {
-  error_fd_[FD_WRITE_END] = fd;
+  error_fd_[FD_WRITE_END].Borrow(fd);
+  error_fd_[FD_READ_END].Reset();
+  error_path_.clear();
+}
+
+void Subprocess::SendErrorToPipe() {
+  if (!CreatePipe(error_fd_)) {
+    EFDLOG(SUBPROC) << "PIPE creation failed on Error:\n" << strerror(errno);
+  }
+  error_path_.clear();
+}
+
+// Hand the read end of a pipe channel over to a new TailCapture
+static std::shared_ptr<TailCapture> CaptureTail(ScopedFD* channel,
+                                                size_t capacity) {
+  if (!channel[FD_READ_END].valid()) return nullptr;
+  return std::make_shared<TailCapture>(std::move(channel[FD_READ_END]),
+                                       capacity);
+}
+
+void Subprocess::SendOutputToTail(size_t capacity) {
+  SendOutputToPipe();
+  output_tail_ = CaptureTail(output_fd_, capacity);
+}
+
+void Subprocess::SendErrorToTail(size_t capacity) {
+  SendErrorToPipe();
+  error_tail_ = CaptureTail(error_fd_, capacity);
+}
+
+std::shared_ptr<TailCapture> Subprocess::GetOutputTail() {
+  return output_tail_;
+}
+
+std::shared_ptr<TailCapture> Subprocess::GetErrorTail() {
+  return error_tail_;
+}
+
+// Open a file written by the child for reading, on first use only
+static void OpenForReading(const std::string& filename, ScopedFD* fd) {
+  if (fd->valid() || filename.empty()) return;
+  int fd_read = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_read == ERROR) {
+    EFDLOG(SUBPROC) << "Error during open() on " << filename << ":\n"
+                    << strerror(errno);
+  } else {
+    fd->Reset(fd_read);
+  }
 }
 
 int Subprocess::GetInputFD() {
-  return input_fd_[FD_READ_END];
+  // for a pipe the parent keeps the write end
+  if (input_fd_[FD_WRITE_END].valid()) return input_fd_[FD_WRITE_END].get();
+  return input_fd_[FD_READ_END].get();
 }
 
 int Subprocess::GetOutputFD() {
-  return output_fd_[FD_READ_END];
+  OpenForReading(output_path_, &output_fd_[FD_READ_END]);
+  return output_fd_[FD_READ_END].get();
 }
 
 int Subprocess::GetErrorFD() {
-  return error_fd_[FD_READ_END];
+  OpenForReading(error_path_, &error_fd_[FD_READ_END]);
+  return error_fd_[FD_READ_END].get();
 }
 
-void Subprocess::Communicate(Subprocess receiver) {
-  int fd[FD_SIZE];
-  int ret = pipe(fd);
+int Subprocess::GetSpawnError() {
+  return spawn_error_;
+}
 
-  if (ret == ERROR) {
-    EFDLOG(SUBPROC) << "PIPE creation failed:\n" << strerror(errno);
-  } else {
-    output_fd_[FD_WRITE_END] = fd[FD_WRITE_END];
-    output_fd_[FD_READ_END] = fd[FD_READ_END];
+pid_t Subprocess::GetPID() {
+  return child_pid_;
+}
+
+int Subprocess::GetPidFD() {
+  return pidfd_.get();
+}
+
+int Subprocess::Communicate(Subprocess& receiver) {
+  Pipeline pipeline;
+  pipeline.Add(*this).Add(receiver);
+  pipeline.Start();
+  pipeline.Wait();
+  return pipeline.PipefailStatus();
+}
+
+CaptureResult Subprocess::RunAndCapture() {
+  return CommunicateWithInput(nullptr, 0);
+}
+
+CaptureResult Subprocess::CommunicateWithInput(const std::string& input) {
+  return CommunicateWithInput(input.data(), input.size());
+}
+
+CaptureResult Subprocess::CommunicateWithInput(const char* input,
+                                               size_t input_size) {
+  CaptureResult result;
+  result.exit_status = kError;
+  if (child_pid_ != NOT_EXIST) {
+    EFDLOG(SUBPROC) << "Capture requires a subprocess that is not started";
+    return result;
+  }
+
+  ReceiveInputFromPipe();
+  SendOutputToPipe();
+  SendErrorToPipe();
+  if (!input_fd_[FD_WRITE_END].valid() || !output_fd_[FD_READ_END].valid() ||
+      !error_fd_[FD_READ_END].valid()) {
+    return result;
+  }
+
+  CreateChildAndExecute();
+  if (child_pid_ != NOT_EXIST) {
+    PumpStreams(input, input_size, &result.output, &result.error);
+  }
+
+  input_fd_[FD_WRITE_END].Reset();
+  output_fd_[FD_READ_END].Reset();
+  error_fd_[FD_READ_END].Reset();
+
+  if (child_pid_ != NOT_EXIST) {
+    result.exit_status = SubprocessWait();
+  }
+  return result;
+}
 
-    Subprocess::CreateChildAndExecute();
+// Append whatever is readable on fd to buffer, false once EOF/error is seen
+static bool ReadAvailable(int fd, std::string* buffer) {
+  // a pipe holds 64KB by default, resize() zero fills what it adds, so
+  // growing by more than a read returns would clear the spare capacity
+  const size_t chunk = 65536;
+  while (true) {
+    size_t used = buffer->size();
+    buffer->resize(used + chunk);
+    ssize_t size = read(fd, &(*buffer)[used], chunk);
+    buffer->resize(used + (size > 0 ? size : 0));
 
-    receiver.ReceiveInputFromFile(fd[FD_READ_END]);
-    receiver.Start();
-    receiver.SubprocessWait();
+    if (size > 0) {
+      if (static_cast<size_t>(size) < chunk) return true;
+      continue;
+    }
+    if (size == ERROR && errno == EINTR) continue;
+    if (size == ERROR && errno == EAGAIN) return true;
+    if (size == ERROR) {
+      EFDLOG(SUBPROC) << "Error reading captured stream:\n"
+                      << strerror(errno);
+    }
+    return false;
+  }
+}
+
+void Subprocess::PumpStreams(const char* input, size_t input_size,
+                             std::string* output, std::string* error) {
+  enum { kInput, kOutput, kError, kStreams };
+  struct pollfd poll_fds[kStreams];
+  poll_fds[kInput].fd = input_fd_[FD_WRITE_END].get();
+  poll_fds[kInput].events = POLLOUT;
+  poll_fds[kOutput].fd = output_fd_[FD_READ_END].get();
+  poll_fds[kOutput].events = POLLIN;
+  poll_fds[kError].fd = error_fd_[FD_READ_END].get();
+  poll_fds[kError].events = POLLIN;
+
+  for (struct pollfd& poll_fd : poll_fds) {
+    int flags = fcntl(poll_fd.fd, F_GETFL);
+    fcntl(poll_fd.fd, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  // a child that exits without reading its input must not kill us
+  ScopedSigpipeBlock sigpipe_block;
+
+  size_t written = 0;
+  if (input_size == 0) {
+    input_fd_[FD_WRITE_END].Reset();
+    poll_fds[kInput].fd = NOT_EXIST;
+  }
+  bool traced = SubprocessTrace::Enabled();
+  bool output_seen = false;
+
+  while (poll_fds[kInput].fd != NOT_EXIST ||
+         poll_fds[kOutput].fd != NOT_EXIST ||
+         poll_fds[kError].fd != NOT_EXIST) {
+    if (poll(poll_fds, kStreams, -1) == ERROR) {
+      if (errno == EINTR) continue;
+      EFDLOG(SUBPROC) << "Error during poll() on streams:\n"
+                      << strerror(errno);
+      break;
+    }
+
+    if (poll_fds[kInput].revents) {
+      ssize_t size = write(poll_fds[kInput].fd, input + written,
+                           input_size - written);
+      if (size > 0) written += size;
+      bool retry = size == ERROR && (errno == EINTR || errno == EAGAIN);
+      if (written == input_size || (size == ERROR && !retry)) {
+        input_fd_[FD_WRITE_END].Reset();
+        poll_fds[kInput].fd = NOT_EXIST;
+        if (traced) {
+          SubprocessTrace::Emit(kTraceStreamBytes, child_pid_, STDIN_FILENO,
+                                written);
+        }
+      }
+    }
+
+    std::string* buffers[kStreams] = {nullptr, output, error};
+    ScopedFD* fds[kStreams] = {nullptr, &output_fd_[FD_READ_END],
+                               &error_fd_[FD_READ_END]};
+    int targets[kStreams] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    for (int stream = kOutput; stream < kStreams; ++stream) {
+      if (!poll_fds[stream].revents) continue;
+      bool open = ReadAvailable(poll_fds[stream].fd, buffers[stream]);
+      if (traced && !output_seen && !buffers[stream]->empty()) {
+        output_seen = true;
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        SubprocessTrace::Emit(kTraceFirstOutput, child_pid_,
+                              targets[stream],
+                              SubprocessTrace::Nanoseconds(exec_time_, now),
+                              now);
+      }
+      if (!open) {
+        fds[stream]->Reset();
+        poll_fds[stream].fd = NOT_EXIST;
+        if (traced) {
+          SubprocessTrace::Emit(kTraceStreamBytes, child_pid_,
+                                targets[stream], buffers[stream]->size());
+        }
+      }
+    }
   }
 }
 
 int Subprocess::SubprocessKill() {
-  int termination_code = ::kill(child_pid_, SIGKILL);
+  // never let kill(-1) reach every process of the user
+  if (child_pid_ == NOT_EXIST) {
+    EFDLOG(SUBPROC) << "Invalid kill:\nchild process was not created";
+    return ERROR;
+  }
+
+  int termination_code = SignalChild(SIGKILL, true);
   if(termination_code == ERROR) {
     EFDLOG(SUBPROC) << "Invalid kill:\n" << strerror(errno);
   }
@@ -374,33 +1429,215 @@ int Subprocess::SubprocessKill() {
 }
 
 int Subprocess::SubprocessWaitForGivenTime(int time_duration) {
-  siginfo_t signal_info;
-  pid_t wait_pid;
-  auto current_time = std::chrono::steady_clock::now();
-  auto final_time = current_time + std::chrono::seconds(time_duration);
-  if(final_time < current_time){
+  return SubprocessWaitForGivenTime(std::chrono::seconds(time_duration));
+}
+
+int Subprocess::SubprocessWaitForGivenTime(
+    std::chrono::nanoseconds time_duration) {
+  if (time_duration < std::chrono::nanoseconds::zero()) {
     return kError;
   }
-  int sleep_duration = 100000;
-  if (kill(child_pid_, SIGNAL) == NOT_EXIST) {
+  auto final_time = std::chrono::steady_clock::now() + time_duration;
+  if (child_pid_ == NOT_EXIST || reaped_) {
     return kChildNotExist;
   }
 
-  while (final_time > std::chrono::steady_clock::now()) {
-    wait_pid = waitid(P_PID, child_pid_,
-                      &signal_info, WEXITED | WSTOPPED | WNOHANG);
+  WaitUntil(final_time);
+  return ReapIfExited();
+}
+
+ExitInfo Subprocess::RunWithTimeout(std::chrono::nanoseconds timeout,
+                                    TimeoutPolicy policy) {
+  ExitInfo info;
+  if (child_pid_ == NOT_EXIST) {
+    // a group of its own, so that signal_group reaches its descendants
+    if (policy.signal_group && group_mode_ == kInheritGroup) {
+      group_mode_ = kNewProcessGroup;
+    }
+    if (Start() != SUCCESS) {
+      info.error = spawn_error_;
+      return info;
+    }
+  } else if (policy.signal_group && group_mode_ == kInheritGroup) {
+    EFDLOG(SUBPROC) << "signal_group ignored, " << child_pid_
+                    << " was started in the group of its parent";
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  bool timed_out = !WaitUntil(deadline);
+  bool killed = false;
+  if (timed_out) {
+    EFDLOG(SUBPROC) << "Deadline passed, sending signal "
+                    << policy.terminate_signal << " to " << child_pid_;
+    SignalChild(policy.terminate_signal, policy.signal_group);
+    killed = !WaitUntil(std::chrono::steady_clock::now() +
+                        policy.grace_period);
+
+    // SIGKILL whatever is left of the group, SignalChild() refuses once
+    // the leader was reaped, e.g. by the ChildRegistry
+    bool group = policy.signal_group && group_mode_ != kInheritGroup;
+    if (killed || group) SignalChild(SIGKILL, policy.signal_group);
+  }
+
+  info = WaitForExit();
+  info.timed_out = timed_out;
+  info.killed = killed;
+  return info;
+}
+
+bool Subprocess::WaitUntil(std::chrono::steady_clock::time_point deadline) {
+  if (exit_slot_) return exit_slot_->WaitUntil(deadline);
+  // pidfd becomes readable once the child exits, nothing wakes us before
+  if (pidfd_.valid()) return PollPidFD(deadline);
 
-    if (signal_info.si_code == CLD_KILLED) {
-      return kStopped;
+  // Fallback for kernels without pidfd_open(): poll waitid() with backoff,
+  // WNOWAIT leaves the child to be reaped by the caller
+  useconds_t sleep_duration = 1000;
+  const useconds_t max_sleep_duration = 100000;
+  while (true) {
+    siginfo_t signal_info;
+    memset(&signal_info, 0, sizeof(signal_info));
+    if (waitid(P_PID, child_pid_, &signal_info,
+               WEXITED | WNOHANG | WNOWAIT | __WALL) == ERROR ||
+        signal_info.si_pid != SUCCESS) {
+      return true;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return false;
     }
+    usleep(std::min<useconds_t>(sleep_duration, remaining.count()));
+    sleep_duration = std::min(sleep_duration * 2, max_sleep_duration);
+  }
+}
 
-    if (signal_info.si_code == CLD_EXITED) {
-      if (wait_pid == SUCCESS && signal_info.si_status == SUCCESS) {
-        return kSuccess;
-      }
-      return kError;
+int Subprocess::SignalChild(int signal_number, bool group) {
+  // the pid of a reaped child, and with it the group id, may be reused
+  if (reaped_ || (exit_slot_ && exit_slot_->Done())) {
+    errno = ESRCH;
+    return ERROR;
+  }
+  bool signal_group = group && group_mode_ != kInheritGroup;
+#ifdef SYS_pidfd_send_signal
+  if (pidfd_.valid()) {
+    // the pidfd names the group of its leader even if the registry reaps
+    // it meanwhile, EINVAL before Linux 6.9
+    unsigned int flags = signal_group ? PIDFD_SIGNAL_PROCESS_GROUP : 0;
+    int ret = syscall(SYS_pidfd_send_signal, pidfd_.get(), signal_number,
+                      nullptr, flags);
+    if (ret != ERROR || flags == 0 || errno != EINVAL) return ret;
+  }
+#endif
+  // the child is the leader, its pid is the group id
+  if (signal_group) return ::kill(-child_pid_, signal_number);
+  return ::kill(child_pid_, signal_number);
+}
+
+void Subprocess::OpenPidFD() {
+#ifdef SYS_pidfd_open
+  if (pidfd_.valid()) return;
+  // pidfd_open() returns a close-on-exec descriptor, ENOSYS before 5.3
+  int pidfd = syscall(SYS_pidfd_open, child_pid_, 0);
+  if (pidfd == ERROR) {
+    if (errno != ENOSYS) {
+      EFDLOG(SUBPROC) << "Error during pidfd_open():\n" << strerror(errno);
     }
-    usleep(sleep_duration);
+  } else {
+    pidfd_.Reset(pidfd);
   }
-  return kInExecution;
+#endif
+}
+
+bool Subprocess::PollPidFD(std::chrono::steady_clock::time_point deadline) {
+  struct pollfd poll_fd;
+  poll_fd.fd = pidfd_.get();
+  poll_fd.events = POLLIN;
+
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() < 0) remaining = std::chrono::nanoseconds::zero();
+
+    struct timespec timeout;
+    timeout.tv_sec = remaining.count() / 1000000000;
+    timeout.tv_nsec = remaining.count() % 1000000000;
+
+    poll_fd.revents = 0;
+    int ret = ppoll(&poll_fd, 1, &timeout, nullptr);
+    if (ret > 0) {
+      return true;
+    }
+    if (ret == SUCCESS) {
+      return false;
+    }
+    if (errno != EINTR) {
+      EFDLOG(SUBPROC) << "Error during ppoll() on pidfd:\n" << strerror(errno);
+      return false;
+    }
+  }
+}
+
+int Subprocess::ReapIfExited() {
+  int wait_status = 0;
+  pid_t pid = ReapChild(WNOHANG, &wait_status, nullptr);
+  if (pid == ERROR) {
+    // reaped by a waitpid(-1) elsewhere in the process
+    if (errno == ECHILD) return kChildNotExist;
+    EFDLOG(SUBPROC) << "Error during waitid():\n" << strerror(errno);
+    return kError;
+  }
+  if (pid == SUCCESS) {
+    return kInExecution;
+  }
+
+  if (WIFSIGNALED(wait_status)) {
+    return kStopped;
+  }
+  if (WEXITSTATUS(wait_status) == SUCCESS) {
+    return kSuccess;
+  }
+  return kError;
+}
+
+pid_t Subprocess::ReapChild(int options, int* wait_status,
+                            struct rusage* usage) {
+  if (child_pid_ == NOT_EXIST || reaped_) {
+    errno = ECHILD;
+    return ERROR;
+  }
+
+  pid_t pid = child_pid_;
+  if (exit_slot_) {
+    // the reaper thread did the waiting, only the slot is read here
+    if (options & WNOHANG) {
+      if (!exit_slot_->Done()) return SUCCESS;
+    } else {
+      exit_slot_->Wait();
+    }
+    if (exit_slot_->state() == ExitSlot::kLost) {
+      errno = exit_slot_->error();
+      return ERROR;
+    }
+    *wait_status = exit_slot_->wait_status();
+    if (usage) *usage = exit_slot_->usage();
+  } else {
+    // __WALL also finds children created without exit signal
+    struct rusage child_usage;
+    do {
+      pid = wait4(child_pid_, wait_status, options | __WALL,
+                  usage ? usage : &child_usage);
+    } while (pid == ERROR && errno == EINTR);
+    if (pid == ERROR && errno == ECHILD) {
+      // reaped elsewhere, e.g. by a reactor, its pid may be reused now
+      reaped_ = true;
+      ClosePidFD();
+      errno = ECHILD;
+    }
+    if (pid == ERROR || pid == SUCCESS) return pid;
+  }
+
+  reaped_ = true;
+  ClosePidFD();
+  return pid;
 }
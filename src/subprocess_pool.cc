@@ -0,0 +1,237 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_pool.cc
+ * @brief   Implementation of SubprocessPool
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/subprocess_pool.h"
+#include "dtu/common/scoped_sigpipe_block.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+#define NOT_EXIST -1
+#define ERROR -1
+#define SUCCESS 0
+#define READ_CHUNK_SIZE 65536
+#define LENGTH_PREFIX_SIZE 4
+
+static size_t ResidentBytes(pid_t pid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/statm";
+  FILE* fp = fopen(path.c_str(), "re");
+  if (!fp) return 0;
+  unsigned long size = 0, resident = 0;
+  int fields = fscanf(fp, "%lu %lu", &size, &resident);
+  fclose(fp);
+  return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+SubprocessPool::SubprocessPool(std::string command, std::string option,
+                               PoolOptions options)
+    : command_(command), option_(option), options_(options) {
+  for (int i = 0; i < options_.workers; ++i) {
+    std::unique_ptr<Worker> worker(new Worker);
+    if (!StartWorker(worker.get())) ++start_failures_;
+    idle_.push_back(worker.get());
+    workers_.push_back(std::move(worker));
+  }
+}
+
+SubprocessPool::~SubprocessPool() {
+  for (auto& worker : workers_) StopWorker(worker.get(), false);
+}
+
+bool SubprocessPool::StartWorker(Worker* worker) {
+  bool start_execution = false;
+  worker->process.reset(new Subprocess(command_, option_, start_execution));
+  worker->process->ReceiveInputFromPipe();
+  worker->process->SendOutputToPipe();
+  worker->jobs = 0;
+  worker->buffered.clear();
+  int error = worker->process->Start();
+  if (error != SUCCESS) {
+    EFDLOG(SUBPROC) << "Pool worker " << command_ << " not started:\n"
+                    << strerror(error);
+    return false;
+  }
+  return true;
+}
+
+void SubprocessPool::StopWorker(Worker* worker, bool failed) {
+  Subprocess* process = worker->process.get();
+  if (!process) return;
+
+  if (process->GetPID() != NOT_EXIST) {
+    if (failed) {
+      // it may never read stdin again, e.g. after a malformed response
+      process->SubprocessKill();
+      process->SubprocessWait();
+    } else {
+      // EOF on stdin is the request to exit, but not every worker obeys
+      process->CloseInput();
+      if (process->SubprocessWaitForGivenTime(options_.stop_timeout) ==
+          Subprocess::kInExecution) {
+        EFDLOG(SUBPROC) << "Pool worker " << process->GetPID()
+                        << " ignored EOF on stdin, killing it";
+        process->SubprocessKill();
+        process->SubprocessWait();
+      }
+    }
+  }
+  worker->process.reset();
+}
+
+bool SubprocessPool::NeedsRespawn(Worker* worker) {
+  if (options_.max_jobs_per_worker &&
+      worker->jobs >= options_.max_jobs_per_worker) {
+    return true;
+  }
+  return options_.max_rss_bytes &&
+         ResidentBytes(worker->process->GetPID()) > options_.max_rss_bytes;
+}
+
+bool SubprocessPool::Run(const std::string& job, std::string* response) {
+  auto begin = std::chrono::steady_clock::now();
+
+  Worker* worker;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++waiting_;
+    idle_cv_.wait(lock, [this] { return !idle_.empty(); });
+    --waiting_;
+    worker = idle_.back();
+    idle_.pop_back();
+  }
+
+  uint64_t start_failures = 0;
+  if (worker->process->GetPID() == NOT_EXIST && !StartWorker(worker)) {
+    ++start_failures;
+  }
+
+  bool done;
+  {
+    ScopedSigpipeBlock sigpipe_block;
+    done = worker->process->GetPID() != NOT_EXIST &&
+           WriteJob(worker, job) && ReadResponse(worker, response);
+  }
+  ++worker->jobs;
+
+  // a failed worker is in an unknown state, replace it like an old one
+  bool respawn = worker->process->GetPID() != NOT_EXIST &&
+                 (!done || NeedsRespawn(worker));
+  if (respawn) {
+    StopWorker(worker, !done);
+    if (!StartWorker(worker)) ++start_failures;
+  }
+
+  double latency_us = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - begin).count();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(worker);
+    if (done) ++jobs_; else ++failed_jobs_;
+    if (respawn) ++respawns_;
+    start_failures_ += start_failures;
+    total_latency_us_ += latency_us;
+    max_latency_us_ = std::max(max_latency_us_, latency_us);
+  }
+  idle_cv_.notify_one();
+  return done;
+}
+
+size_t SubprocessPool::QueueDepth() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return waiting_;
+}
+
+PoolStats SubprocessPool::Stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  PoolStats stats;
+  stats.queue_depth = waiting_;
+  stats.jobs = jobs_;
+  stats.failed_jobs = failed_jobs_;
+  stats.respawns = respawns_;
+  stats.start_failures = start_failures_;
+  uint64_t total = jobs_ + failed_jobs_;
+  stats.mean_latency_us = total ? total_latency_us_ / total : 0;
+  stats.max_latency_us = max_latency_us_;
+  return stats;
+}
+
+bool SubprocessPool::WriteJob(Worker* worker, const std::string& job) {
+  std::string frame;
+  if (options_.protocol == kLengthPrefixed) {
+    uint32_t length = htonl(job.size());
+    frame.append(reinterpret_cast<const char*>(&length), LENGTH_PREFIX_SIZE);
+    frame.append(job);
+  } else {
+    frame = job + '\n';
+  }
+
+  int fd = worker->process->GetInputFD();
+  size_t written = 0;
+  while (written < frame.size()) {
+    ssize_t size = write(fd, frame.data() + written, frame.size() - written);
+    if (size == ERROR) {
+      if (errno == EINTR) continue;
+      EFDLOG(SUBPROC) << "Error writing job to worker:\n" << strerror(errno);
+      return false;
+    }
+    written += size;
+  }
+  return true;
+}
+
+bool SubprocessPool::ReadMore(Worker* worker) {
+  char buffer[READ_CHUNK_SIZE];
+  while (true) {
+    ssize_t size = read(worker->process->GetOutputFD(), buffer,
+                        sizeof(buffer));
+    if (size > 0) {
+      worker->buffered.append(buffer, size);
+      return true;
+    }
+    if (size == ERROR && errno == EINTR) continue;
+    if (size == ERROR) {
+      EFDLOG(SUBPROC) << "Error reading worker response:\n"
+                      << strerror(errno);
+    }
+    return false;
+  }
+}
+
+bool SubprocessPool::ReadResponse(Worker* worker, std::string* response) {
+  std::string& buffered = worker->buffered;
+
+  if (options_.protocol == kLengthPrefixed) {
+    while (buffered.size() < LENGTH_PREFIX_SIZE) {
+      if (!ReadMore(worker)) return false;
+    }
+    uint32_t length;
+    memcpy(&length, buffered.data(), LENGTH_PREFIX_SIZE);
+    size_t frame_size = LENGTH_PREFIX_SIZE + ntohl(length);
+    while (buffered.size() < frame_size) {
+      if (!ReadMore(worker)) return false;
+    }
+    response->assign(buffered, LENGTH_PREFIX_SIZE,
+                     frame_size - LENGTH_PREFIX_SIZE);
+    buffered.erase(0, frame_size);
+    return true;
+  }
+
+  size_t searched = 0;
+  size_t newline;
+  while ((newline = buffered.find('\n', searched)) == std::string::npos) {
+    searched = buffered.size();
+    if (!ReadMore(worker)) return false;
+  }
+  response->assign(buffered, 0, newline);
+  buffered.erase(0, newline + 1);
+  return true;
+}
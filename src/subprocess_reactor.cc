@@ -0,0 +1,233 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_reactor.cc
+ * @brief   Implementation of SubprocessReactor
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/subprocess_reactor.h"
+
+#include "dtu/common/subprocess_trace.h"
+
+// waitid() id type of a pidfd, from Linux 5.4
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define NOT_EXIST -1
+#define ERROR -1
+#define SUCCESS 0
+#define MAX_EVENTS 256
+#define READ_CHUNK_SIZE 65536
+
+SubprocessReactor::SubprocessReactor() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == ERROR) {
+    EFDLOG(SUBPROC) << "Error during epoll_create1():\n" << strerror(errno);
+  }
+}
+
+SubprocessReactor::~SubprocessReactor() {
+  for (auto& it : entries_) {
+    if (it.second.pid != NOT_EXIST) close(it.first);
+  }
+  if (epoll_fd_ != NOT_EXIST) close(epoll_fd_);
+}
+
+bool SubprocessReactor::Watch(Subprocess& process, ExitCallback on_exit) {
+  if (process.GetPidFD() == NOT_EXIST) {
+    EFDLOG(SUBPROC) << "Reactor needs a pidfd for pid " << process.GetPID();
+    return false;
+  }
+  // the registry reaps it already, the two would race for the exit
+  if (process.UsesChildRegistry()) {
+    EFDLOG(SUBPROC) << "Pid " << process.GetPID()
+                    << " is reaped by the ChildRegistry";
+    return false;
+  }
+
+  // own a duplicate so the reactor does not depend on process lifetime
+  int pidfd = fcntl(process.GetPidFD(), F_DUPFD_CLOEXEC, 0);
+  if (pidfd == ERROR) {
+    EFDLOG(SUBPROC) << "Error duplicating pidfd:\n" << strerror(errno);
+    return false;
+  }
+
+  Entry entry;
+  entry.pid = process.GetPID();
+  entry.exec_time = process.GetExecTime();
+  entry.on_exit = std::move(on_exit);
+  if (!Add(pidfd, EPOLLIN, std::move(entry))) {
+    close(pidfd);
+    return false;
+  }
+  return true;
+}
+
+bool SubprocessReactor::WatchOutput(int fd, OutputCallback on_output) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == ERROR || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == ERROR) {
+    EFDLOG(SUBPROC) << "Error setting O_NONBLOCK on output fd:\n"
+                    << strerror(errno);
+    return false;
+  }
+
+  Entry entry;
+  entry.pid = NOT_EXIST;
+  entry.on_output = std::move(on_output);
+  return Add(fd, EPOLLIN, std::move(entry));
+}
+
+bool SubprocessReactor::WatchReady(int fd, uint32_t events,
+                                   ReadyCallback on_ready) {
+  Entry entry;
+  entry.pid = NOT_EXIST;
+  entry.on_ready = std::move(on_ready);
+  return Add(fd, events, std::move(entry));
+}
+
+bool SubprocessReactor::Add(int fd, uint32_t events, Entry entry) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  ++syscalls_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == ERROR) {
+    EFDLOG(SUBPROC) << "Error during epoll_ctl():\n" << strerror(errno);
+    return false;
+  }
+  entries_[fd] = std::move(entry);
+  return true;
+}
+
+void SubprocessReactor::Remove(int fd) {
+  ++syscalls_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == ERROR) {
+    EFDLOG(SUBPROC) << "Error during epoll_ctl():\n" << strerror(errno);
+  }
+  entries_.erase(fd);
+}
+
+int SubprocessReactor::RunOnce(int timeout_ms) {
+  struct epoll_event events[MAX_EVENTS];
+  ++syscalls_;
+  int count = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout_ms);
+  if (count == ERROR) {
+    if (errno == EINTR) return 0;
+    EFDLOG(SUBPROC) << "Error during epoll_wait():\n" << strerror(errno);
+    return ERROR;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    int fd = events[i].data.fd;
+    auto it = entries_.find(fd);
+    if (it == entries_.end()) continue;
+
+    // callbacks may add or remove entries, work on a copy
+    Entry entry = it->second;
+    if (entry.pid != NOT_EXIST) {
+      HandleExit(fd, entry);
+    } else if (entry.on_ready) {
+      HandleReady(fd, events[i].events, entry);
+    } else {
+      HandleOutput(fd, entry);
+    }
+  }
+  return count;
+}
+
+void SubprocessReactor::Run() {
+  while (!entries_.empty()) {
+    if (RunOnce(-1) == ERROR) break;
+  }
+}
+
+size_t SubprocessReactor::Pending() const {
+  return entries_.size();
+}
+
+uint64_t SubprocessReactor::SyscallCount() const {
+  return syscalls_;
+}
+
+pid_t SubprocessReactor::ReapPidFD(int pidfd, int* wait_status) {
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  int ret;
+  do {
+    ret = waitid(static_cast<idtype_t>(P_PIDFD), pidfd, &info,
+                 WEXITED | WNOHANG | __WALL);
+  } while (ret == ERROR && errno == EINTR);
+  // si_pid stays 0 while the child is running
+  if (ret == ERROR || info.si_pid == SUCCESS) return ret;
+
+  switch (info.si_code) {
+    case CLD_EXITED:
+      *wait_status = (info.si_status & 0xff) << 8;
+      break;
+    case CLD_DUMPED:
+      *wait_status = info.si_status | 0x80;
+      break;
+    default:
+      *wait_status = info.si_status;
+  }
+  return info.si_pid;
+}
+
+void SubprocessReactor::HandleExit(int fd, const Entry& entry) {
+  int wait_status = 0;
+  ++syscalls_;
+  pid_t pid = ReapPidFD(fd, &wait_status);
+  if (pid == 0) return;  // spurious wakeup, child still running
+  std::chrono::steady_clock::time_point exit_time =
+      std::chrono::steady_clock::now();
+
+  Remove(fd);
+  ++syscalls_;
+  close(fd);
+  if (pid == ERROR) {
+    EFDLOG(SUBPROC) << "Error during waitid() on pidfd of " << entry.pid
+                    << ":\n" << strerror(errno);
+    if (entry.on_exit) entry.on_exit(entry.pid, kExitLost);
+    return;
+  }
+  if (SubprocessTrace::Enabled()) {
+    SubprocessTrace::Emit(
+        kTraceExit, pid, NOT_EXIST,
+        SubprocessTrace::Nanoseconds(entry.exec_time, exit_time), exit_time);
+    SubprocessTrace::Emit(kTraceReap, pid, NOT_EXIST, wait_status, exit_time);
+  }
+  if (entry.on_exit) entry.on_exit(entry.pid, wait_status);
+}
+
+void SubprocessReactor::HandleOutput(int fd, const Entry& entry) {
+  char buffer[READ_CHUNK_SIZE];
+  while (true) {
+    ++syscalls_;
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size > 0) {
+      if (entry.on_output) entry.on_output(fd, buffer, size);
+      continue;
+    }
+    if (size == ERROR && errno == EINTR) continue;
+    if (size == ERROR && errno == EAGAIN) return;
+
+    if (size == ERROR) {
+      EFDLOG(SUBPROC) << "Error reading output fd:\n" << strerror(errno);
+    }
+    Remove(fd);
+    if (entry.on_output) entry.on_output(fd, nullptr, 0);
+    return;
+  }
+}
+
+void SubprocessReactor::HandleReady(int fd, uint32_t events,
+                                    const Entry& entry) {
+  // one-shot, removed first so the callback can watch fd again
+  Remove(fd);
+  entry.on_ready(fd, events);
+}
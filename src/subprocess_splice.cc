@@ -0,0 +1,196 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_splice.cc
+ * @brief   Implementation of the zero-copy data paths
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/subprocess_splice.h"
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+#include "dtu/common/subprocess.h"
+
+#define FD_READ_END 0
+#define FD_WRITE_END 1
+#define ERROR -1
+#define SPLICE_CHUNK_SIZE (1 << 20)
+#define COPY_BUFFER_SIZE 65536
+
+static bool IsPipe(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// splice()/tee()/vmsplice() refuse this fd pair, a copy still works
+static bool SpliceUnsupported(int error) {
+  return error == EINVAL || error == ENOSYS;
+}
+
+static bool WriteAll(int fd, const char* data, size_t size) {
+  while (size) {
+    ssize_t written = write(fd, data, size);
+    if (written == ERROR) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// read()/write() fallback, out_fd2 receives a copy unless it is -1
+static ssize_t CopyStream(int in_fd, int out_fd, int out_fd2, size_t length) {
+  char buffer[COPY_BUFFER_SIZE];
+  size_t moved = 0;
+  while (moved < length) {
+    ssize_t size = read(in_fd, buffer,
+                        std::min<size_t>(sizeof(buffer), length - moved));
+    if (size == 0) break;
+    if (size == ERROR) {
+      if (errno == EINTR) continue;
+      EFDLOG(SUBPROC) << "Error during read() in copy:\n" << strerror(errno);
+      return ERROR;
+    }
+    if ((out_fd2 != ERROR && !WriteAll(out_fd2, buffer, size)) ||
+        !WriteAll(out_fd, buffer, size)) {
+      EFDLOG(SUBPROC) << "Error during write() in copy:\n" << strerror(errno);
+      return ERROR;
+    }
+    moved += size;
+  }
+  return moved;
+}
+
+// splice exactly size bytes already sitting in in_pipe to out_fd
+static bool SpliceAll(int in_pipe, int out_fd, size_t size) {
+  while (size) {
+    ssize_t moved = splice(in_pipe, nullptr, out_fd, nullptr, size,
+                           SPLICE_F_MOVE);
+    if (moved <= 0) {
+      if (moved == ERROR && errno == EINTR) continue;
+      // e.g. O_APPEND files on older kernels
+      if (moved == ERROR && SpliceUnsupported(errno)) {
+        return CopyStream(in_pipe, out_fd, ERROR, size) ==
+               static_cast<ssize_t>(size);
+      }
+      return false;
+    }
+    size -= moved;
+  }
+  return true;
+}
+
+// file to file, bounce through a private pipe since splice needs one
+static ssize_t SpliceThroughPipe(int in_fd, int out_fd, size_t length) {
+  int fd[FD_SIZE];
+  if (pipe2(fd, O_CLOEXEC) == ERROR) {
+    return CopyStream(in_fd, out_fd, ERROR, length);
+  }
+
+  size_t moved = 0;
+  ssize_t result = 0;
+  while (moved < length) {
+    ssize_t size = splice(in_fd, nullptr, fd[FD_WRITE_END], nullptr,
+                          std::min<size_t>(SPLICE_CHUNK_SIZE, length - moved),
+                          SPLICE_F_MOVE);
+    if (size == 0) break;
+    if (size == ERROR) {
+      if (errno == EINTR) continue;
+      if (moved == 0 && SpliceUnsupported(errno)) {
+        result = CopyStream(in_fd, out_fd, ERROR, length);
+      } else {
+        EFDLOG(SUBPROC) << "Error during splice():\n" << strerror(errno);
+        result = ERROR;
+      }
+      break;
+    }
+    if (!SpliceAll(fd[FD_READ_END], out_fd, size)) {
+      EFDLOG(SUBPROC) << "Error during splice():\n" << strerror(errno);
+      result = ERROR;
+      break;
+    }
+    moved += size;
+    result = moved;
+  }
+
+  close(fd[FD_READ_END]);
+  close(fd[FD_WRITE_END]);
+  return result;
+}
+
+ssize_t SpliceStream(int in_fd, int out_fd, size_t length) {
+  if (!IsPipe(in_fd) && !IsPipe(out_fd)) {
+    return SpliceThroughPipe(in_fd, out_fd, length);
+  }
+
+  size_t moved = 0;
+  while (moved < length) {
+    ssize_t size = splice(in_fd, nullptr, out_fd, nullptr,
+                          std::min<size_t>(SPLICE_CHUNK_SIZE, length - moved),
+                          SPLICE_F_MOVE);
+    if (size == 0) break;
+    if (size == ERROR) {
+      if (errno == EINTR) continue;
+      if (moved == 0 && SpliceUnsupported(errno)) {
+        return CopyStream(in_fd, out_fd, ERROR, length);
+      }
+      EFDLOG(SUBPROC) << "Error during splice():\n" << strerror(errno);
+      return ERROR;
+    }
+    moved += size;
+  }
+  return moved;
+}
+
+ssize_t TeeStream(int in_pipe, int out_pipe, int out_fd) {
+  size_t moved = 0;
+  while (true) {
+    // duplicate without consuming, then consume the same bytes
+    ssize_t size = tee(in_pipe, out_pipe, SPLICE_CHUNK_SIZE, 0);
+    if (size == 0) break;
+    if (size == ERROR) {
+      if (errno == EINTR) continue;
+      if (moved == 0 && SpliceUnsupported(errno)) {
+        return CopyStream(in_pipe, out_fd, out_pipe, SIZE_MAX);
+      }
+      EFDLOG(SUBPROC) << "Error during tee():\n" << strerror(errno);
+      return ERROR;
+    }
+    if (!SpliceAll(in_pipe, out_fd, size)) {
+      EFDLOG(SUBPROC) << "Error during splice() after tee():\n"
+                      << strerror(errno);
+      return ERROR;
+    }
+    moved += size;
+  }
+  return moved;
+}
+
+ssize_t VmspliceBuffer(int out_pipe, const char* data, size_t size) {
+  size_t moved = 0;
+  while (moved < size) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(data + moved);
+    iov.iov_len = size - moved;
+    ssize_t written = vmsplice(out_pipe, &iov, 1, 0);
+    if (written == ERROR) {
+      if (errno == EINTR) continue;
+      if (moved == 0 && SpliceUnsupported(errno)) {
+        return WriteAll(out_pipe, data, size) ? size : ERROR;
+      }
+      EFDLOG(SUBPROC) << "Error during vmsplice():\n" << strerror(errno);
+      return ERROR;
+    }
+    moved += written;
+  }
+  return moved;
+}
@@ -0,0 +1,198 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_trace.cc
+ * @brief   Implementation of the subprocess lifecycle instrumentation
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/subprocess_trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#define NS_PER_US 1000.0
+
+std::atomic<SubprocessObserver*> SubprocessTrace::observer_(nullptr);
+
+SubprocessObserver* SubprocessTrace::SetObserver(
+    SubprocessObserver* observer) {
+  return observer_.exchange(observer);
+}
+
+void SubprocessTrace::Emit(TraceEvent event, pid_t pid, int stream,
+                           int64_t value,
+                           std::chrono::steady_clock::time_point time) {
+  SubprocessObserver* observer = observer_.load(std::memory_order_acquire);
+  if (!observer) return;
+  TraceRecord record;
+  record.event = event;
+  record.pid = pid;
+  record.stream = stream;
+  record.value = value;
+  record.time = time;
+  observer->OnEvent(record);
+}
+
+// bucket i holds values below 2^i, bucket 0 only 0
+static int BucketOf(uint64_t value) {
+  return value ? 64 - __builtin_clzll(value) - (value >> 63) : 0;
+}
+
+void TraceHistogram::Record(uint64_t value) {
+  buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::Count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::Sum() const {
+  return sum_.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::Percentile(double fraction) const {
+  uint64_t count = Count();
+  if (!count) return 0;
+  uint64_t rank = static_cast<uint64_t>(fraction * (count - 1)) + 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return i ? (uint64_t(1) << i) - 1 : 0;
+  }
+  return UINT64_MAX;
+}
+
+void SubprocessMetrics::OnEvent(const TraceRecord& record) {
+  switch (record.event) {
+    case kTraceExec:
+      spawn_latency_.Record(record.value);
+      break;
+    case kTraceSpawnEnd:
+      spawns_.fetch_add(1, std::memory_order_relaxed);
+      if (record.value) {
+        spawn_failures_.fetch_add(1, std::memory_order_relaxed);
+      }
+      break;
+    case kTraceFirstOutput:
+      first_output_latency_.Record(record.value);
+      break;
+    case kTraceStreamBytes:
+      if (record.stream >= STDIN_FILENO && record.stream <= STDERR_FILENO) {
+        stream_bytes_[record.stream].Record(record.value);
+      }
+      break;
+    case kTraceExit:
+      if (record.value >= 0) lifetime_.Record(record.value);
+      break;
+    case kTraceReap:
+      reaped_.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case kTraceSpawnStart:
+      break;
+  }
+}
+
+static void PrintHistogram(std::ostringstream& out, const char* name,
+                           const TraceHistogram& histogram) {
+  uint64_t count = histogram.Count();
+  out << name << ": count " << count;
+  if (count) {
+    out << " mean " << histogram.Sum() / count << " p50 <="
+        << histogram.Percentile(0.5) << " p99 <="
+        << histogram.Percentile(0.99);
+  }
+  out << "\n";
+}
+
+std::string SubprocessMetrics::Summary() const {
+  std::ostringstream out;
+  out << "spawns: " << Spawns() << " failed " << SpawnFailures()
+      << " reaped " << Reaped() << "\n";
+  PrintHistogram(out, "spawn_ns", spawn_latency_);
+  PrintHistogram(out, "first_output_ns", first_output_latency_);
+  PrintHistogram(out, "lifetime_ns", lifetime_);
+  PrintHistogram(out, "stdin_bytes", stream_bytes_[STDIN_FILENO]);
+  PrintHistogram(out, "stdout_bytes", stream_bytes_[STDOUT_FILENO]);
+  PrintHistogram(out, "stderr_bytes", stream_bytes_[STDERR_FILENO]);
+  return out.str();
+}
+
+ChromeTraceWriter::ChromeTraceWriter(const std::string& filename)
+    : fp_(fopen(filename.c_str(), "we")) {
+  if (fp_) fputs("{\"traceEvents\":[\n", fp_);
+}
+
+ChromeTraceWriter::~ChromeTraceWriter() {
+  Close();
+}
+
+void ChromeTraceWriter::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!fp_) return;
+  fputs("\n]}\n", fp_);
+  fclose(fp_);
+  fp_ = nullptr;
+}
+
+void ChromeTraceWriter::OnEvent(const TraceRecord& record) {
+  static const char* const kStreams[] = {"stdin", "stdout", "stderr"};
+  const char* stream = record.stream >= STDIN_FILENO &&
+                       record.stream <= STDERR_FILENO
+                           ? kStreams[record.stream]
+                           : "";
+  double us = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  record.time.time_since_epoch()).count() / NS_PER_US;
+  long tid = syscall(SYS_gettid);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!fp_) return;
+  fputs(first_ ? "" : ",\n", fp_);
+  first_ = false;
+
+  // Start() spans the calling thread, the child's run is an async span
+  switch (record.event) {
+    case kTraceSpawnStart:
+      fprintf(fp_, "{\"name\":\"spawn\",\"ph\":\"B\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%ld}", us, getpid(), tid);
+      break;
+    case kTraceSpawnEnd:
+      fprintf(fp_, "{\"name\":\"spawn\",\"ph\":\"E\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%ld,\"args\":{\"child\":%d,"
+              "\"errno\":%lld}}", us, getpid(), tid, record.pid,
+              static_cast<long long>(record.value));
+      break;
+    case kTraceExec:
+      fprintf(fp_, "{\"name\":\"run\",\"cat\":\"child\",\"ph\":\"b\","
+              "\"id\":%d,\"ts\":%.3f,\"pid\":%d,\"tid\":%ld}",
+              record.pid, us, getpid(), tid);
+      break;
+    case kTraceExit:
+      fprintf(fp_, "{\"name\":\"run\",\"cat\":\"child\",\"ph\":\"e\","
+              "\"id\":%d,\"ts\":%.3f,\"pid\":%d,\"tid\":%ld}",
+              record.pid, us, getpid(), tid);
+      break;
+    case kTraceFirstOutput:
+    case kTraceStreamBytes:
+      fprintf(fp_, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%ld,\"args\":{\"child\":%d,"
+              "\"stream\":\"%s\",\"value\":%lld}}",
+              record.event == kTraceFirstOutput ? "first output" : "bytes",
+              us, getpid(), tid, record.pid, stream,
+              static_cast<long long>(record.value));
+      break;
+    case kTraceReap:
+      fprintf(fp_, "{\"name\":\"reap\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%ld,\"args\":{\"child\":%d,"
+              "\"status\":%lld}}", us, getpid(), tid, record.pid,
+              static_cast<long long>(record.value));
+      break;
+  }
+}
@@ -0,0 +1,588 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_uring.cc
+ * @brief   Implementation of SubprocessUring
+ *          Talks to the kernel through the raw io_uring system calls,
+ *          no liburing dependency.
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/subprocess_uring.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "dtu/common/subprocess_trace.h"
+
+#define NOT_EXIST -1
+#define ERROR -1
+#define SUCCESS 0
+#define BUFFER_GROUP 0
+
+// appeared in Linux 6.7, after these headers
+#define URING_OP_READ_MULTISHOT 49
+#define URING_OP_WAITID 50
+
+// waitid() id type of a pidfd, from Linux 5.4
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+// byte offset of the ring tail, it overlays bufs[0].resv
+#define BUFFER_RING_TAIL_OFFSET 14
+
+static int UringSetup(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int UringRegister(int ring_fd, unsigned opcode, void* arg,
+                         unsigned count) {
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+// waitpid() status word from what waitid() reports
+static int WaitStatus(const siginfo_t& info) {
+  switch (info.si_code) {
+    case CLD_EXITED:
+      return (info.si_status & 0xff) << 8;
+    case CLD_DUMPED:
+      return info.si_status | 0x80;
+    default:
+      return info.si_status;
+  }
+}
+
+// kTraceExit and kTraceReap of a child whose exit was just consumed
+static void EmitExit(pid_t pid,
+                     std::chrono::steady_clock::time_point exec_time,
+                     int wait_status) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  SubprocessTrace::Emit(kTraceExit, pid, NOT_EXIST,
+                        SubprocessTrace::Nanoseconds(exec_time, now), now);
+  SubprocessTrace::Emit(kTraceReap, pid, NOT_EXIST, wait_status, now);
+}
+
+SubprocessUring::SubprocessUring(UringOptions options) {
+  if (!Setup(options)) {
+    Teardown();
+    EFDLOG(SUBPROC) << "io_uring unavailable, using epoll";
+  }
+}
+
+SubprocessUring::~SubprocessUring() {
+  // in-flight operations die with the ring, only our pidfds need closing
+  for (auto& it : operations_) {
+    if (it.second.kind == kWaitid || it.second.kind == kPidfdPoll) {
+      close(it.second.fd);
+    }
+  }
+  Teardown();
+}
+
+bool SubprocessUring::Setup(const UringOptions& options) {
+  if (options.buffer_count == 0 || options.buffer_count > 32768 ||
+      (options.buffer_count & (options.buffer_count - 1))) {
+    EFDLOG(SUBPROC) << "buffer_count must be a power of 2 up to 32768";
+    return false;
+  }
+
+  // single issuer with deferred task work saves a wakeup per completion
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                 IORING_SETUP_DEFER_TASKRUN;
+  params.cq_entries = options.queue_depth * 2;
+  ring_fd_ = UringSetup(options.queue_depth, &params);
+  if (ring_fd_ == ERROR && errno == EINVAL) {
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = options.queue_depth * 2;
+    ring_fd_ = UringSetup(options.queue_depth, &params);
+  }
+  if (ring_fd_ == ERROR) {
+    EFDLOG(SUBPROC) << "Error during io_uring_setup():\n" << strerror(errno);
+    return false;
+  }
+
+  // one mapping for both rings, timeouts through the getevents argument
+  unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                      IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required) {
+    EFDLOG(SUBPROC) << "io_uring lacks required features";
+    return false;
+  }
+
+  size_t sq_size = params.sq_off.array +
+                   params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+  ring_size_ = std::max(sq_size, cq_size);
+  void* ring = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    EFDLOG(SUBPROC) << "Error mapping io_uring rings:\n" << strerror(errno);
+    return false;
+  }
+  ring_ = ring;
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    EFDLOG(SUBPROC) << "Error mapping io_uring sqes:\n" << strerror(errno);
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  char* base = static_cast<char*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+  // sqe slots are used in order, so the index array is the identity
+  unsigned* sq_array =
+      reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; ++i) sq_array[i] = i;
+
+  // provided buffer ring, Linux 5.19+
+  buffer_count_ = options.buffer_count;
+  buffer_size_ = options.buffer_size;
+  buffer_ring_size_ = buffer_count_ * sizeof(struct io_uring_buf);
+  void* buffer_ring = mmap(nullptr, buffer_ring_size_,
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, NOT_EXIST, 0);
+  if (buffer_ring == MAP_FAILED) {
+    EFDLOG(SUBPROC) << "Error mapping buffer ring:\n" << strerror(errno);
+    return false;
+  }
+  buffer_ring_ = static_cast<struct io_uring_buf*>(buffer_ring);
+
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+  registration.ring_entries = buffer_count_;
+  registration.bgid = BUFFER_GROUP;
+  if (UringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &registration,
+                    1) == ERROR) {
+    EFDLOG(SUBPROC) << "Error registering buffer ring:\n" << strerror(errno);
+    return false;
+  }
+
+  buffers_ = new char[static_cast<size_t>(buffer_count_) * buffer_size_];
+  for (unsigned i = 0; i < buffer_count_; ++i) RecycleBuffer(i);
+
+  // both are optional, pidfd polling and one-shot reads cover older kernels
+  std::vector<char> probe_block(sizeof(struct io_uring_probe) +
+                                256 * sizeof(struct io_uring_probe_op));
+  struct io_uring_probe* probe =
+      reinterpret_cast<struct io_uring_probe*>(probe_block.data());
+  if (UringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, 256) == SUCCESS &&
+      probe->last_op >= URING_OP_WAITID) {
+    uses_waitid_ =
+        probe->ops[URING_OP_WAITID].flags & IO_URING_OP_SUPPORTED;
+    multishot_read_ =
+        probe->ops[URING_OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED;
+  }
+  return true;
+}
+
+void SubprocessUring::Teardown() {
+  // closing the ring cancels what is in flight before memory goes away
+  if (ring_fd_ != NOT_EXIST) close(ring_fd_);
+  ring_fd_ = NOT_EXIST;
+  if (sqes_) munmap(sqes_, sqes_size_);
+  sqes_ = nullptr;
+  if (ring_) munmap(ring_, ring_size_);
+  ring_ = nullptr;
+  if (buffer_ring_) munmap(buffer_ring_, buffer_ring_size_);
+  buffer_ring_ = nullptr;
+  delete[] buffers_;
+  buffers_ = nullptr;
+}
+
+bool SubprocessUring::UsesUring() const {
+  return ring_fd_ != NOT_EXIST;
+}
+
+bool SubprocessUring::UsesWaitid() const {
+  return uses_waitid_;
+}
+
+bool SubprocessUring::Watch(Subprocess& process, ExitCallback on_exit) {
+  if (!UsesUring()) return reactor_.Watch(process, std::move(on_exit));
+  if (process.GetPidFD() == NOT_EXIST) {
+    EFDLOG(SUBPROC) << "io_uring engine needs a pidfd for pid "
+                    << process.GetPID();
+    return false;
+  }
+  // the registry reaps it already, the two would race for the exit
+  if (process.UsesChildRegistry()) {
+    EFDLOG(SUBPROC) << "Pid " << process.GetPID()
+                    << " is reaped by the ChildRegistry";
+    return false;
+  }
+
+  Operation operation;
+  operation.pid = process.GetPID();
+  operation.exec_time = process.GetExecTime();
+  operation.on_exit = std::move(on_exit);
+  // own a duplicate so the engine does not depend on process lifetime
+  operation.fd = fcntl(process.GetPidFD(), F_DUPFD_CLOEXEC, 0);
+  if (operation.fd == ERROR) {
+    EFDLOG(SUBPROC) << "Error duplicating pidfd:\n" << strerror(errno);
+    return false;
+  }
+  operation.kind = uses_waitid_ ? kWaitid : kPidfdPoll;
+  Add(std::move(operation));
+  return true;
+}
+
+bool SubprocessUring::WatchOutput(int fd, OutputCallback on_output) {
+  if (!UsesUring()) return reactor_.WatchOutput(fd, std::move(on_output));
+
+  Operation operation;
+  operation.kind = kRead;
+  operation.fd = fd;
+  operation.on_output = std::move(on_output);
+  Add(std::move(operation));
+  return true;
+}
+
+bool SubprocessUring::Write(int fd, const char* data, size_t size,
+                            WriteCallback on_written) {
+  Operation operation;
+  operation.kind = kWrite;
+  operation.fd = fd;
+  operation.data.assign(data, size);
+  operation.written = 0;
+  operation.on_written = std::move(on_written);
+
+  // one write per fd in flight, so the child reads them in order
+  auto queue = write_queues_.find(fd);
+  if (queue != write_queues_.end()) {
+    queue->second.push_back(std::move(operation));
+    ++queued_writes_;
+    return true;
+  }
+  if (!StartWrite(std::move(operation))) return false;
+  write_queues_[fd];
+  return true;
+}
+
+bool SubprocessUring::StartWrite(Operation operation) {
+  if (UsesUring()) {
+    Add(std::move(operation));
+    return true;
+  }
+
+  int flags = fcntl(operation.fd, F_GETFL);
+  if (flags == ERROR ||
+      fcntl(operation.fd, F_SETFL, flags | O_NONBLOCK) == ERROR) {
+    EFDLOG(SUBPROC) << "Error setting O_NONBLOCK on input fd:\n"
+                    << strerror(errno);
+    return false;
+  }
+  std::shared_ptr<Operation> pending(new Operation(std::move(operation)));
+  return ArmWrite(pending);
+}
+
+void SubprocessUring::StartNextWrite(int fd) {
+  for (;;) {
+    auto queue = write_queues_.find(fd);
+    if (queue == write_queues_.end()) return;
+    if (queue->second.empty()) {
+      write_queues_.erase(queue);
+      return;
+    }
+    Operation next = std::move(queue->second.front());
+    queue->second.pop_front();
+    --queued_writes_;
+
+    WriteCallback on_written = next.on_written;
+    if (StartWrite(std::move(next))) return;
+    if (on_written) on_written(fd, ERROR);
+  }
+}
+
+// the epoll fallback feeds the data in pieces as fd becomes ready
+bool SubprocessUring::ArmWrite(std::shared_ptr<Operation> pending) {
+  return reactor_.WatchReady(pending->fd, EPOLLOUT,
+                             [this, pending](int fd, uint32_t) {
+    ssize_t size = write(fd, pending->data.data() + pending->written,
+                         pending->data.size() - pending->written);
+    if (size > 0) pending->written += size;
+    bool retry = size == ERROR && (errno == EINTR || errno == EAGAIN);
+    if (pending->written < pending->data.size() && (size > 0 || retry)) {
+      ArmWrite(pending);
+      return;
+    }
+    if (size == ERROR) {
+      EFDLOG(SUBPROC) << "Error writing input fd:\n" << strerror(errno);
+    }
+    StartNextWrite(fd);
+    if (pending->on_written) {
+      pending->on_written(fd, size == ERROR ? ERROR : pending->written);
+    }
+  });
+}
+
+uint64_t SubprocessUring::Add(Operation operation) {
+  uint64_t token = next_token_++;
+  Operation& stored = operations_[token];
+  stored = std::move(operation);
+  Prepare(token, stored);
+  return token;
+}
+
+struct io_uring_sqe* SubprocessUring::NextSqe() {
+  unsigned tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    // ring full, hand what we have to the kernel without waiting
+    Enter(0, 0);
+  }
+  struct io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void SubprocessUring::Prepare(uint64_t token, Operation& operation) {
+  struct io_uring_sqe* sqe = NextSqe();
+  sqe->user_data = token;
+
+  switch (operation.kind) {
+    case kWaitid:
+      // fields as read by io_waitid_prep(), __WALL also finds children
+      // created without exit signal
+      sqe->opcode = URING_OP_WAITID;
+      sqe->len = P_PIDFD;
+      sqe->fd = operation.fd;
+      sqe->file_index = WEXITED | __WALL;
+      sqe->addr2 = reinterpret_cast<uint64_t>(&operation.info);
+      break;
+    case kPidfdPoll:
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = operation.fd;
+      sqe->poll32_events = POLLIN;
+      break;
+    case kRead:
+      // the kernel picks a buffer from the ring once data is there, a
+      // multishot read stays armed and completes once per buffer
+      sqe->opcode = multishot_read_ ? URING_OP_READ_MULTISHOT
+                                    : IORING_OP_READ;
+      sqe->fd = operation.fd;
+      sqe->off = static_cast<uint64_t>(-1);
+      sqe->len = multishot_read_ ? 0 : buffer_size_;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = BUFFER_GROUP;
+      break;
+    case kWrite:
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = operation.fd;
+      sqe->off = static_cast<uint64_t>(-1);
+      sqe->addr = reinterpret_cast<uint64_t>(operation.data.data() +
+                                             operation.written);
+      sqe->len = operation.data.size() - operation.written;
+      break;
+  }
+
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+  ++sq_pending_;
+}
+
+int SubprocessUring::Enter(unsigned min_complete, int timeout_ms) {
+  unsigned flags = IORING_ENTER_GETEVENTS;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec timeout;
+  void* argument = nullptr;
+  size_t argument_size = 0;
+  if (min_complete && timeout_ms >= 0) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    flags |= IORING_ENTER_EXT_ARG;
+    argument = &arg;
+    argument_size = sizeof(arg);
+  }
+
+  ++syscalls_;
+  int submitted = syscall(__NR_io_uring_enter, ring_fd_, sq_pending_,
+                          min_complete, flags, argument, argument_size);
+  if (submitted > 0) sq_pending_ -= submitted;
+  if (submitted == ERROR && errno != ETIME && errno != EINTR) {
+    EFDLOG(SUBPROC) << "Error during io_uring_enter():\n" << strerror(errno);
+    return ERROR;
+  }
+  return SUCCESS;
+}
+
+int SubprocessUring::RunOnce(int timeout_ms) {
+  if (!UsesUring()) return reactor_.RunOnce(timeout_ms);
+
+  // submit and wait in one call unless completions are already queued
+  bool ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_;
+  if ((sq_pending_ || !ready) && Enter(ready ? 0 : 1, timeout_ms) == ERROR) {
+    return ERROR;
+  }
+
+  int count = 0;
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head, ++count) {
+    // copy and release the slot first, completions may queue more work
+    struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    Complete(cqe.user_data, cqe.res, cqe.flags);
+  }
+  return count;
+}
+
+void SubprocessUring::Run() {
+  while (Pending()) {
+    if (RunOnce(-1) == ERROR) break;
+  }
+}
+
+size_t SubprocessUring::Pending() const {
+  return (UsesUring() ? operations_.size() : reactor_.Pending()) +
+         queued_writes_;
+}
+
+uint64_t SubprocessUring::SyscallCount() const {
+  return UsesUring() ? syscalls_ : reactor_.SyscallCount();
+}
+
+void SubprocessUring::RecycleBuffer(unsigned buffer_id) {
+  struct io_uring_buf* buffer =
+      &buffer_ring_[buffer_tail_ & (buffer_count_ - 1)];
+  buffer->addr = reinterpret_cast<uint64_t>(
+      buffers_ + static_cast<size_t>(buffer_id) * buffer_size_);
+  buffer->len = buffer_size_;
+  buffer->bid = buffer_id;
+  ++buffer_tail_;
+
+  uint16_t* ring_tail = reinterpret_cast<uint16_t*>(
+      reinterpret_cast<char*>(buffer_ring_) + BUFFER_RING_TAIL_OFFSET);
+  __atomic_store_n(ring_tail, buffer_tail_, __ATOMIC_RELEASE);
+}
+
+void SubprocessUring::Complete(uint64_t token, int result, unsigned flags) {
+  auto it = operations_.find(token);
+  if (it == operations_.end()) return;
+  Operation& operation = it->second;
+  bool retry = result == -EINTR || result == -EAGAIN;
+
+  switch (operation.kind) {
+    case kWaitid: {
+      if (retry) {
+        Prepare(token, operation);
+        return;
+      }
+      Operation done = std::move(operation);
+      operations_.erase(it);
+      close(done.fd);
+      if (result < 0) {
+        EFDLOG(SUBPROC) << "Error during IORING_OP_WAITID:\n"
+                        << strerror(-result);
+        if (done.on_exit) {
+          done.on_exit(done.pid, SubprocessReactor::kExitLost);
+        }
+        return;
+      }
+      if (SubprocessTrace::Enabled()) {
+        EmitExit(done.pid, done.exec_time, WaitStatus(done.info));
+      }
+      if (done.on_exit) done.on_exit(done.pid, WaitStatus(done.info));
+      return;
+    }
+
+    case kPidfdPoll: {
+      int wait_status = 0;
+      ++syscalls_;
+      pid_t pid = SubprocessReactor::ReapPidFD(operation.fd, &wait_status);
+      if (pid == SUCCESS) {
+        Prepare(token, operation);  // spurious wakeup, child still running
+        return;
+      }
+      Operation done = std::move(operation);
+      operations_.erase(it);
+      close(done.fd);
+      if (pid == ERROR) {
+        EFDLOG(SUBPROC) << "Error during waitid() on pidfd of " << done.pid
+                        << ":\n" << strerror(errno);
+        if (done.on_exit) {
+          done.on_exit(done.pid, SubprocessReactor::kExitLost);
+        }
+        return;
+      }
+      if (SubprocessTrace::Enabled()) {
+        EmitExit(done.pid, done.exec_time, wait_status);
+      }
+      if (done.on_exit) done.on_exit(done.pid, wait_status);
+      return;
+    }
+
+    case kRead: {
+      unsigned buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+      bool has_buffer = flags & IORING_CQE_F_BUFFER;
+      if (result > 0) {
+        if (operation.on_output) {
+          operation.on_output(operation.fd,
+                              buffers_ + buffer_id * buffer_size_, result);
+        }
+        RecycleBuffer(buffer_id);
+        if (flags & IORING_CQE_F_MORE) return;
+        // the callback may have added operations, look the entry up again
+        it = operations_.find(token);
+        if (it != operations_.end()) Prepare(token, it->second);
+        return;
+      }
+      if (has_buffer) RecycleBuffer(buffer_id);
+      if (retry || result == -ENOBUFS) {
+        Prepare(token, operation);
+        return;
+      }
+      if (result < 0) {
+        EFDLOG(SUBPROC) << "Error reading output fd:\n" << strerror(-result);
+      }
+      Operation done = std::move(operation);
+      operations_.erase(it);
+      if (done.on_output) done.on_output(done.fd, nullptr, 0);
+      return;
+    }
+
+    case kWrite: {
+      if (result > 0) operation.written += result;
+      if (operation.written < operation.data.size() &&
+          (result > 0 || retry)) {
+        Prepare(token, operation);
+        return;
+      }
+      Operation done = std::move(operation);
+      operations_.erase(it);
+      if (result < 0) {
+        EFDLOG(SUBPROC) << "Error writing input fd:\n" << strerror(-result);
+      }
+      StartNextWrite(done.fd);
+      if (done.on_written) {
+        done.on_written(done.fd, result < 0 ? ERROR : done.written);
+      }
+      return;
+    }
+  }
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    tail_capture.cc
+ * @brief   Implementation of TailBuffer and TailCapture
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include "dtu/common/tail_capture.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "dtu/util/switch_logging.h"
+
+#define CACHE_LINE_SIZE 64
+#define DRAIN_CHUNK_SIZE 65536
+#define ERROR -1
+
+TailBuffer::TailBuffer(size_t capacity)
+    : capacity_((std::max<size_t>(capacity, 1) + CACHE_LINE_SIZE - 1) /
+                CACHE_LINE_SIZE * CACHE_LINE_SIZE) {
+  void* ring = nullptr;
+  if (posix_memalign(&ring, CACHE_LINE_SIZE, capacity_) != 0) {
+    EFDLOG(SUBPROC) << "Error allocating a tail buffer of " << capacity_
+                    << " bytes";
+    capacity_ = 0;
+    return;
+  }
+  ring_.reset(static_cast<char*>(ring));
+}
+
+void TailBuffer::Append(const char* data, size_t size) {
+  total_ += size;
+  if (capacity_ == 0 || size == 0) return;
+
+  // only the end of data can survive
+  if (size > capacity_) {
+    data += size - capacity_;
+    size = capacity_;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t offset = written_ % capacity_;
+  size_t first = std::min(size, capacity_ - offset);
+  memcpy(ring_.get() + offset, data, first);
+  memcpy(ring_.get(), data + first, size - first);
+  written_ += size;
+}
+
+std::string TailBuffer::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t size = std::min<uint64_t>(written_, capacity_);
+  size_t offset = (written_ - size) % std::max<size_t>(capacity_, 1);
+  size_t first = std::min(size, capacity_ - offset);
+
+  std::string snapshot;
+  snapshot.reserve(size);
+  snapshot.append(ring_.get() + offset, first);
+  snapshot.append(ring_.get(), size - first);
+  return snapshot;
+}
+
+TailCapture::TailCapture(ScopedFD fd, size_t capacity)
+    : buffer_(capacity), fd_(std::move(fd)) {
+  int stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd == ERROR || !fd_.valid()) {
+    EFDLOG(SUBPROC) << "Tail capture not started:\n" << strerror(errno);
+    if (stop_fd != ERROR) close(stop_fd);
+    finished_ = true;
+    return;
+  }
+  stop_fd_.Reset(stop_fd);
+
+  // reads go until EAGAIN, so one poll() covers a burst of output
+  int flags = fcntl(fd_.get(), F_GETFL);
+  fcntl(fd_.get(), F_SETFL, flags | O_NONBLOCK);
+  thread_ = std::thread(&TailCapture::Drain, this);
+}
+
+TailCapture::~TailCapture() {
+  if (stop_fd_.valid()) {
+    uint64_t stop = 1;
+    ssize_t size = write(stop_fd_.get(), &stop, sizeof(stop));
+    (void)size;
+  }
+  Wait();
+}
+
+void TailCapture::Wait() {
+  std::lock_guard<std::mutex> lock(join_mutex_);
+  if (thread_.joinable()) thread_.join();
+}
+
+void TailCapture::Drain() {
+  enum { kData, kStop, kFds };
+  struct pollfd poll_fds[kFds];
+  poll_fds[kData].fd = fd_.get();
+  poll_fds[kData].events = POLLIN;
+  poll_fds[kStop].fd = stop_fd_.get();
+  poll_fds[kStop].events = POLLIN;
+
+  char chunk[DRAIN_CHUNK_SIZE];
+  while (true) {
+    ssize_t size = read(fd_.get(), chunk, sizeof(chunk));
+    if (size > 0) {
+      buffer_.Append(chunk, size);
+      continue;
+    }
+    if (size == 0) break;
+    if (errno == EINTR) continue;
+    if (errno != EAGAIN) {
+      EFDLOG(SUBPROC) << "Error reading captured tail:\n" << strerror(errno);
+      break;
+    }
+
+    // nothing buffered, sleep until there is or the owner goes away
+    if (poll(poll_fds, kFds, -1) == ERROR && errno != EINTR) break;
+    if (poll_fds[kStop].revents) return;
+  }
+  finished_ = true;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2021-2022 Enflame. All Rights Reserved.
+ *
+ * @file    subprocess_async_test.cc
+ * @brief   Contains test cases for the coroutine awaitables of
+ *          subprocess_async.h, built as C++20
+ *
+ * @par     Copyright (c)
+ *          Enflame Tech Company.
+ * @par     History:
+ */
+
+#include <string>
+#include <vector>
+
+#include "dtu/common/subprocess_async.h"
+
+#if !defined(__cpp_impl_coroutine)
+#error "subprocess_async_test needs a compiler with C++20 coroutines"
+#endif
+
+EF_DEFINE_MOD_STR_ARR
+
+static DetachedTask AwaitExit(AsyncSubprocess* async, int* status) {
+  *status = co_await async->Exited();
+}
+
+static DetachedTask AwaitOutput(AsyncSubprocess* async, std::string* output,
+                                int* status) {
+  AsyncStream stdout_stream = async->Stdout();
+  // smaller than what the child writes, so ReadSome() resumes repeatedly
+  char buffer[4];
+  ssize_t size;
+  while ((size = co_await stdout_stream.ReadSome(buffer)) > 0) {
+    output->append(buffer, size);
+  }
+  *status = co_await async->Exited();
+}
+
+// TESTCASE 1 corresponding to USECASE 23
+void ExitedTest() {
+  SubprocessReactor reactor;
+  Subprocess process({"sh", "-c", "sleep 0.1; exit 7"});
+  AsyncSubprocess async(process, reactor);
+
+  // the coroutine suspends until the child exits, Run() resumes it
+  int status = -1;
+  AwaitExit(&async, &status);
+  EFCHECK(status == -1);
+  reactor.Run();
+  EFLOG(DBG) << "exit code: " << status;
+  EFCHECK(status == 7);
+}
+
+// TESTCASE 2 corresponding to USECASE 23
+void ReadSomeTest() {
+  const int kChildren = 3;
+  bool start_execution = false;
+  SubprocessReactor reactor;
+
+  // one thread drives every child, output arrives in two bursts
+  std::vector<Subprocess> processes;
+  for (int i = 0; i < kChildren; ++i) {
+    processes.emplace_back(
+        std::initializer_list<std::string>{
+            "sh", "-c",
+            "echo first " + std::to_string(i) + "; sleep 0.1; "
+            "echo second; exit " + std::to_string(i)},
+        start_execution);
+    processes.back().SendOutputToPipe();
+    EFCHECK(processes.back().Start() == 0);
+  }
+
+  std::vector<AsyncSubprocess> asyncs;
+  for (Subprocess& process : processes) asyncs.emplace_back(process, reactor);
+  std::vector<std::string> outputs(kChildren);
+  std::vector<int> statuses(kChildren, -1);
+  for (int i = 0; i < kChildren; ++i) {
+    AwaitOutput(&asyncs[i], &outputs[i], &statuses[i]);
+  }
+  reactor.Run();
+
+  for (int i = 0; i < kChildren; ++i) {
+    EFLOG(DBG) << "child " << i << " exit code: " << statuses[i]
+               << ", output: " << outputs[i];
+    EFCHECK(outputs[i] == "first " + std::to_string(i) + "\nsecond\n");
+    EFCHECK(statuses[i] == i);
+  }
+}
+
+int main() {
+  EFLOG(DBG) << "\nTEST 1: ExitedTest\n";
+  ExitedTest();
+
+  EFLOG(DBG) << "\nTEST 2: ReadSomeTest\n";
+  ReadSomeTest();
+  return 0;
+}
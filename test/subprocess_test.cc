@@ -13,7 +13,30 @@
  * @par     History:
  */
 
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "dtu/common/child_registry.h"
+#include "dtu/common/environment.h"
+#include "dtu/common/pipeline.h"
+#include "dtu/common/record_reader.h"
+#include "dtu/common/spawn_server.h"
 #include "dtu/common/subprocess.h"
+#include "dtu/common/subprocess_pool.h"
+#include "dtu/common/subprocess_reactor.h"
+#include "dtu/common/subprocess_splice.h"
+#include "dtu/common/subprocess_trace.h"
+#include "dtu/common/subprocess_uring.h"
+#include "dtu/common/tail_capture.h"
 EF_DEFINE_MOD_STR_ARR
 void PrintStatus(int process_status) {
   EFLOG(DBG) << "process_status: " << process_status;
@@ -398,6 +421,1144 @@ void WaitAfterSleep() {
   list_process.SubprocessWait();
 }
 
+// TESTCASE 24 corresponding to USECASE 14
+void LaunchBackends() {
+  std::string command = "ls";
+  std::string option = "-l";
+  bool start_execution = false;
+  std::string output_file = "launch_backend_output.log";
+  LaunchBackend backends[] = {kPosixSpawn, kClone3, kVfork};
+
+  for (LaunchBackend backend : backends) {
+    Subprocess process(command, option, start_execution);
+    process.SetLaunchBackend(backend);
+    process.SendOutputToFile(output_file);
+    process.Start();
+    EFLOG(DBG) << "backend " << backend << " exit code: "
+               << process.SubprocessWait();
+  }
+
+  // signals are blocked only around the clone, the child execs with the
+  // mask of its parent and the parent gets it back
+  sigset_t blocked;
+  sigset_t old_mask;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+  pthread_sigmask(SIG_BLOCK, nullptr, &blocked);
+  Subprocess mask_process("grep", "SigBlk /proc/self/status",
+                          start_execution);
+  mask_process.SetLaunchBackend(kClone3);
+  CaptureResult result = mask_process.RunAndCapture();
+  sigset_t after;
+  pthread_sigmask(SIG_SETMASK, &old_mask, &after);
+  EFCHECK(sigismember(&after, SIGUSR2) && !sigismember(&after, SIGUSR1));
+
+  unsigned long long bits = 0;
+  for (int signal_number = 1; signal_number <= 64; ++signal_number) {
+    if (sigismember(&blocked, signal_number) == 1) {
+      bits |= 1ULL << (signal_number - 1);
+    }
+  }
+  char expected[64];
+  snprintf(expected, sizeof(expected), "SigBlk:\t%016llx\n", bits);
+  EFLOG(DBG) << "child " << result.output;
+  EFCHECK(result.output == expected);
+}
+
+// TESTCASE 25 corresponding to USECASE 6
+void SubSecondWaitFor() {
+  std::string command = "sleep";
+  std::string option = "0.3";
+
+  Subprocess process(command, option);
+
+  // child is still sleeping, expected to be in execution
+  int process_status =
+      process.SubprocessWaitForGivenTime(std::chrono::milliseconds(50));
+  PrintStatus(process_status);
+  EFCHECK(process_status == Subprocess::kInExecution);
+
+  // exit is noticed as soon as it happens, not on a polling tick
+  auto begin = std::chrono::steady_clock::now();
+  process_status =
+      process.SubprocessWaitForGivenTime(std::chrono::milliseconds(1000));
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - begin);
+  PrintStatus(process_status);
+  EFLOG(DBG) << "waited " << elapsed.count() << " ms";
+  // the child had about 250 ms left, a 1 s tick would take the full second
+  EFCHECK(process_status == Subprocess::kSuccess);
+  EFCHECK(elapsed < std::chrono::milliseconds(600));
+}
+
+// TESTCASE 26 corresponding to USECASE 15
+void ReactorTest() {
+  bool start_execution = false;
+  SubprocessReactor reactor;
+
+  Subprocess list_process("ls", "-l", start_execution);
+  list_process.SendOutputToPipe();
+  list_process.Start();
+
+  Subprocess sleep_process("sleep", "0.2");
+  Subprocess failed_process("ls", "/does/not/exist", start_execution);
+  failed_process.SendErrorToFile(nullptr);
+  failed_process.Start();
+
+  size_t output_bytes = 0;
+  auto on_exit = [](pid_t pid, int wait_status) {
+    EFLOG(DBG) << "pid " << pid << " exit code: " << WEXITSTATUS(wait_status);
+  };
+  reactor.Watch(list_process, on_exit);
+  reactor.Watch(sleep_process, on_exit);
+  reactor.Watch(failed_process, on_exit);
+  reactor.WatchOutput(list_process.GetOutputFD(),
+                      [&output_bytes](int, const char*, size_t size) {
+    output_bytes += size;
+  });
+
+  // every child and pipe is serviced from this thread
+  reactor.Run();
+  EFLOG(DBG) << "output bytes: " << output_bytes;
+
+  // the registry reaps its children itself
+  Subprocess registry_process("true", "", start_execution);
+  registry_process.UseChildRegistry();
+  registry_process.Start();
+  EFCHECK(!reactor.Watch(registry_process, on_exit));
+  EFCHECK(registry_process.SubprocessWait() == 0);
+
+  // a child reaped behind the reactor's back is reported, not dropped
+  Subprocess stolen_process("true", "", start_execution);
+  stolen_process.Start();
+  int lost_status = 0;
+  EFCHECK(reactor.Watch(stolen_process, [&lost_status](pid_t, int status) {
+    lost_status = status;
+  }));
+  EFCHECK(waitpid(stolen_process.GetPID(), nullptr, 0) ==
+          stolen_process.GetPID());
+  reactor.Run();
+  EFCHECK(lost_status == SubprocessReactor::kExitLost);
+  // and the Subprocess no longer trusts its pid
+  EFCHECK(stolen_process.SubprocessWait() == -1);
+  EFCHECK(stolen_process.SubprocessKill() == -1);
+}
+
+// TESTCASE 27 corresponding to USECASE 16
+void CaptureInMemory() {
+  bool start_execution = false;
+
+  Subprocess list_process("ls", "-l /does/not/exist .", start_execution);
+  CaptureResult result = list_process.RunAndCapture();
+  EFLOG(DBG) << "exit status: " << result.exit_status;
+  EFLOG(DBG) << "stdout bytes: " << result.output.size();
+  EFLOG(DBG) << "stderr: " << result.error;
+  EFCHECK(result.exit_status != 0 && !result.error.empty());
+
+  Subprocess sort_process("sort", "", start_execution);
+  result = sort_process.CommunicateWithInput("pear\napple\nfig\n");
+  EFLOG(DBG) << "sorted: " << result.output;
+  EFCHECK(result.exit_status == 0 && result.output == "apple\nfig\npear\n");
+
+  // far more than a pipe holds in both directions at once
+  std::string input(8 << 20, 'x');
+  Subprocess cat_process("cat", "", start_execution);
+  result = cat_process.CommunicateWithInput(input);
+  EFLOG(DBG) << "echoed " << result.output.size() << " of " << input.size()
+             << " bytes, match: " << (result.output == input);
+  EFCHECK(result.exit_status == 0 && result.output == input);
+}
+
+// TESTCASE 28 corresponding to USECASE 17
+void PipelineTest() {
+  bool start_execution = false;
+  Subprocess list_process("ls", "-l", start_execution);
+  Subprocess grep_process("grep", "CMake", start_execution);
+  Subprocess count_process("wc", "-l", start_execution);
+  count_process.SendOutputToFile("pipeline_output.log");
+
+  Pipeline pipeline;
+  pipeline.Add(list_process).Add(grep_process).Add(count_process);
+  pipeline.SetPipeCapacity(1 << 20);
+  pipeline.Start();
+  for (int status : pipeline.Wait()) {
+    EFLOG(DBG) << "stage status: " << status;
+  }
+
+  // failing middle stage is reported even though the last one succeeds
+  Subprocess cat_process("cat", "/does/not/exist", start_execution);
+  Subprocess sort_process("sort", "", start_execution);
+  cat_process.SendErrorToFile(nullptr);
+  sort_process.SendOutputToFile(nullptr);
+  Pipeline failing_pipeline;
+  failing_pipeline.Add(cat_process).Add(sort_process);
+  failing_pipeline.Start();
+  failing_pipeline.Wait();
+  EFLOG(DBG) << "pipefail status: " << failing_pipeline.PipefailStatus();
+
+  // a stage that can not start stops the launch, the stage before it is
+  // killed and reaped instead of blocking on a pipe nobody reads
+  Subprocess sleep_process("sleep", "30", start_execution);
+  Subprocess missing_process("no_such_command_in_path", "",
+                             start_execution);
+  Subprocess last_process("wc", "-l", start_execution);
+  Pipeline broken_pipeline;
+  broken_pipeline.Add(sleep_process).Add(missing_process).Add(last_process);
+  auto begin = std::chrono::steady_clock::now();
+  EFCHECK(!broken_pipeline.Start());
+  EFCHECK(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+  EFCHECK(sleep_process.GetPID() != -1 &&
+          kill(sleep_process.GetPID(), 0) == -1 && errno == ESRCH);
+  EFCHECK(missing_process.GetPID() == -1 && last_process.GetPID() == -1);
+  // no stage is left holding a closed pipe end
+  EFCHECK(last_process.GetInputFD() == -1);
+}
+
+// TESTCASE 29 corresponding to USECASE 18
+void ZeroCopyTest() {
+  bool start_execution = false;
+
+  // fan out stdout of ls to a log file and to the stdin of wc
+  Subprocess list_process("ls", "-l", start_execution);
+  Subprocess count_process("wc", "-l", start_execution);
+  list_process.SendOutputToPipe();
+  count_process.ReceiveInputFromPipe();
+  count_process.SendOutputToFile("splice_count_output.log");
+  list_process.Start();
+  count_process.Start();
+
+  int log_fd = open("splice_tee_output.log",
+                    O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0640);
+  EFLOG(DBG) << "tee bytes: " << TeeStream(list_process.GetOutputFD(),
+                                           count_process.GetInputFD(),
+                                           log_fd);
+  close(log_fd);
+  count_process.CloseInput();
+  list_process.SubprocessWait();
+  count_process.SubprocessWait();
+
+  // feed a file to a child without copying through user space
+  Subprocess bytes_process("wc", "-c", start_execution);
+  bytes_process.ReceiveInputFromPipe();
+  bytes_process.Start();
+  int file_fd = open("splice_tee_output.log", O_RDONLY | O_CLOEXEC);
+  EFLOG(DBG) << "spliced bytes: "
+             << SpliceStream(file_fd, bytes_process.GetInputFD());
+  close(file_fd);
+  bytes_process.CloseInput();
+  bytes_process.SubprocessWait();
+}
+
+// TESTCASE 30 corresponding to USECASE 19
+void SpawnServerTest() {
+  bool start_execution = false;
+  SpawnServer::Instance().Start();
+
+  Subprocess list_process("ls", "-l", start_execution);
+  list_process.SetLaunchBackend(kSpawnServer);
+  list_process.SendOutputToFile("spawn_server_output.log");
+  list_process.Start();
+  EFLOG(DBG) << "exit code: " << list_process.SubprocessWait();
+
+  Subprocess failed_process("sl", "", start_execution);
+  failed_process.SetLaunchBackend(kSpawnServer);
+  failed_process.Start();
+  EFLOG(DBG) << "exit code: " << failed_process.SubprocessWait();
+
+  // environment and directory changed after the server started reach the
+  // child, a relative path is found from the new directory
+  setenv("SPAWN_SERVER_STAGE", "late", 1);
+  mkdir("spawn_server_dir", 0700);
+  FILE* fp = fopen("spawn_server_dir/spawn_server_tool", "w");
+  fputs("#!/bin/sh\necho \"$SPAWN_SERVER_STAGE $(basename \"$(pwd -P)\")\"\n",
+        fp);
+  fclose(fp);
+  chmod("spawn_server_dir/spawn_server_tool", 0700);
+  EFCHECK(chdir("spawn_server_dir") == 0);
+  Subprocess tool_process("./spawn_server_tool", "", start_execution);
+  tool_process.SetLaunchBackend(kSpawnServer);
+  CaptureResult result = tool_process.RunAndCapture();
+  EFCHECK(chdir("..") == 0);
+  EFLOG(DBG) << "tool output: " << result.output;
+  EFCHECK(result.exit_status == 0 &&
+          result.output == "late spawn_server_dir\n");
+  unsetenv("SPAWN_SERVER_STAGE");
+  remove("spawn_server_dir/spawn_server_tool");
+  rmdir("spawn_server_dir");
+
+  // without a server the launch goes through posix_spawn
+  SpawnServer::Instance().Stop();
+  Subprocess direct_process("ls", "-l", start_execution);
+  direct_process.SetLaunchBackend(kSpawnServer);
+  direct_process.SendOutputToFile("spawn_server_output.log");
+  direct_process.Start();
+  EFLOG(DBG) << "exit code: " << direct_process.SubprocessWait();
+}
+
+// TESTCASE 31 corresponding to USECASE 20
+void PoolTest() {
+  PoolOptions options;
+  options.workers = 2;
+  options.max_jobs_per_worker = 3;
+
+  // cat answers every line with the same line
+  SubprocessPool line_pool("cat", "", options);
+  int echoed = 0;
+  for (int i = 0; i < 10; ++i) {
+    std::string job = "job " + std::to_string(i);
+    std::string response;
+    if (line_pool.Run(job, &response) && response == job) ++echoed;
+  }
+  PoolStats stats = line_pool.Stats();
+  EFLOG(DBG) << "echoed " << echoed << " jobs, respawns: " << stats.respawns
+             << ", mean latency us: " << stats.mean_latency_us;
+
+  options.protocol = kLengthPrefixed;
+  SubprocessPool frame_pool("cat", "", options);
+  std::string response;
+  frame_pool.Run(std::string("binary\0\njob", 11), &response);
+  EFLOG(DBG) << "framed response bytes: " << response.size();
+
+  // workers that never exit on their own are killed, Run() never blocks
+  FILE* fp = fopen("pool_stubborn_worker", "w");
+  fputs("#!/bin/sh\nread line; echo \"$line\"\nexec sleep 30\n", fp);
+  fclose(fp);
+  fp = fopen("pool_mute_worker", "w");
+  fputs("#!/bin/sh\nexec sleep 30 >&-\n", fp);
+  fclose(fp);
+  chmod("pool_stubborn_worker", 0700);
+  chmod("pool_mute_worker", 0700);
+
+  PoolOptions stop_options;
+  stop_options.workers = 1;
+  stop_options.max_jobs_per_worker = 1;
+  stop_options.stop_timeout = std::chrono::milliseconds(100);
+  auto begin = std::chrono::steady_clock::now();
+  {
+    // retired after each job, it ignores EOF on stdin
+    SubprocessPool stubborn_pool("./pool_stubborn_worker", "", stop_options);
+    EFCHECK(stubborn_pool.Run("first", &response) && response == "first");
+    EFCHECK(stubborn_pool.Run("second", &response) && response == "second");
+    EFCHECK(stubborn_pool.Stats().respawns == 2);
+
+    // closes stdout without answering, a failed worker is killed at once
+    SubprocessPool mute_pool("./pool_mute_worker", "", stop_options);
+    EFCHECK(!mute_pool.Run("job", &response));
+    EFCHECK(mute_pool.Stats().failed_jobs == 1);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - begin);
+  EFLOG(DBG) << "stopping workers took " << elapsed.count() << " ms";
+  EFCHECK(elapsed < std::chrono::seconds(5));
+
+  // a worker that can not be started fails its jobs and is counted
+  SubprocessPool missing_pool("./no_such_worker", "", stop_options);
+  EFCHECK(!missing_pool.Run("job", &response));
+  EFCHECK(missing_pool.Stats().start_failures == 2);
+  remove("pool_stubborn_worker");
+  remove("pool_mute_worker");
+}
+
+// TESTCASE 32 corresponding to USECASE 21
+void ArgvConstruction() {
+  // with shell words the quoted "hello world" is a single argument
+  Subprocess quoted_process("printf", "'%s|' \"hello world\" x", false,
+                            kShellWords);
+  EFLOG(DBG) << "quoted: " << quoted_process.RunAndCapture().output;
+
+  // without it only spaces split, quotes and backslashes stay as given
+  Subprocess legacy_process("printf", "%s| it's C:\\dir\\ \"x\"", false);
+  std::string legacy_output = legacy_process.RunAndCapture().output;
+  EFLOG(DBG) << "legacy: " << legacy_output;
+  EFCHECK(legacy_output == "it's|C:\\dir\\|\"x\"|");
+
+  Subprocess list_process({"printf", "%s|", "no splitting here", ""}, false);
+  EFLOG(DBG) << "initializer list: " << list_process.RunAndCapture().output;
+
+  std::vector<std::string> arguments = {"printf", "%s|", "a b", "c"};
+  Subprocess range_process(arguments.begin(), arguments.end(), false);
+
+  // the argv table lives with the object, moving it keeps it valid
+  std::vector<Subprocess> processes;
+  processes.push_back(std::move(range_process));
+  EFLOG(DBG) << "iterator range: " << processes[0].RunAndCapture().output;
+}
+
+static size_t OpenFDCount() {
+  size_t count = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  if (!dir) return 0;
+  while (readdir(dir)) ++count;
+  closedir(dir);
+  return count;
+}
+
+static size_t ResidentKilobytes() {
+  unsigned long size = 0, resident = 0;
+  FILE* fp = fopen("/proc/self/statm", "re");
+  if (!fp) return 0;
+  if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+  fclose(fp);
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// TESTCASE 33 corresponding to USECASE 22
+void DescriptorLeakStress() {
+  // SUBPROCESS_STRESS_SPAWNS=1000000 for the full soak run
+  const char* spawns_env = getenv("SUBPROCESS_STRESS_SPAWNS");
+  long spawns = spawns_env ? atol(spawns_env) : 2000;
+  const long warmup = 100;
+  const size_t rss_slack_kb = 1024;
+
+  size_t fd_count = 0, rss_kb = 0;
+  for (long i = 0; i < spawns + warmup; ++i) {
+    if (i == warmup) {
+      fd_count = OpenFDCount();
+      rss_kb = ResidentKilobytes();
+    }
+
+    // every channel kind, and a move, per iteration
+    Subprocess process("true", "", false);
+    process.ReceiveInputFromPipe();
+    process.SendOutputToFile("stress_output.log");
+    process.SendErrorToFile(nullptr);
+    process.Start();
+    Subprocess moved_process(std::move(process));
+    moved_process.CloseInput();
+    moved_process.GetOutputFD();
+    moved_process.SubprocessWait();
+  }
+
+  EFLOG(DBG) << spawns << " spawns, fds " << fd_count << " -> "
+             << OpenFDCount() << ", rss " << rss_kb << " kB -> "
+             << ResidentKilobytes() << " kB";
+  EFCHECK(OpenFDCount() == fd_count) << "descriptor leak";
+  EFCHECK(ResidentKilobytes() <= rss_kb + rss_slack_kb) << "memory leak";
+}
+
+// TESTCASE 34 corresponding to USECASE 23
+void ReadinessTest() {
+  bool start_execution = false;
+  SubprocessReactor reactor;
+
+  Subprocess echo_process("echo", "ready", start_execution);
+  echo_process.SendOutputToPipe();
+  echo_process.Start();
+
+  // one-shot watches, the callbacks read and reap themselves
+  std::string output;
+  SubprocessReactor::ReadyCallback on_output =
+      [&output, &reactor, &on_output](int fd, uint32_t) {
+    char buffer[64];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size > 0) {
+      output.append(buffer, size);
+      reactor.WatchReady(fd, EPOLLIN, on_output);
+    }
+  };
+  reactor.WatchReady(echo_process.GetOutputFD(), EPOLLIN, on_output);
+  int exit_code = -1;
+  EFCHECK(reactor.WatchReady(echo_process.GetPidFD(), EPOLLIN,
+                             [&echo_process, &exit_code](int, uint32_t) {
+    exit_code = echo_process.SubprocessWait();
+    EFLOG(DBG) << "exit code: " << exit_code;
+  }));
+
+  reactor.Run();
+  EFLOG(DBG) << "output: " << output;
+  EFCHECK(output == "ready\n");
+  EFCHECK(exit_code == 0);
+}
+
+static std::string UringRoundTrip(const UringOptions& options,
+                                  int* exit_status) {
+  bool start_execution = false;
+  SubprocessUring engine(options);
+  EFLOG(DBG) << "io_uring: " << engine.UsesUring()
+             << ", waitid: " << engine.UsesWaitid();
+
+  Subprocess cat_process("cat", "", start_execution);
+  cat_process.ReceiveInputFromPipe();
+  cat_process.SendOutputToPipe();
+  cat_process.Start();
+
+  std::string output;
+  engine.WatchOutput(cat_process.GetOutputFD(),
+                     [&output](int, const char* data, size_t size) {
+    output.append(data, size);
+  });
+  EFCHECK(engine.Watch(cat_process, [exit_status](pid_t, int wait_status) {
+    *exit_status = wait_status;
+  }));
+
+  // written in order, EOF once both are
+  engine.Write(cat_process.GetInputFD(), "hello ", 6);
+  engine.Write(cat_process.GetInputFD(), "uring\n", 6,
+               [&cat_process](int, ssize_t result) {
+    EFLOG(DBG) << "written: " << result;
+    cat_process.CloseInput();
+  });
+  engine.Run();
+  EFLOG(DBG) << "output: " << output;
+  return output;
+}
+
+// TESTCASE 35 corresponding to USECASE 24
+void UringTest() {
+  int exit_status = -1;
+  UringOptions options;
+  std::string uring_output = UringRoundTrip(options, &exit_status);
+  EFCHECK(uring_output == "hello uring\n");
+  EFCHECK(WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == 0);
+
+  // a buffer count that is not a power of 2 leaves it on epoll
+  exit_status = -1;
+  options.buffer_count = 3;
+  std::string epoll_output = UringRoundTrip(options, &exit_status);
+  EFCHECK(epoll_output == uring_output);
+  EFCHECK(WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == 0);
+}
+
+// TESTCASE 36 corresponding to USECASE 25
+void BatchSpawnTest() {
+  std::vector<CommandSpec> specs(4);
+  specs[0].argv = {"echo", "first"};
+  specs[0].output_file = "batch_output.txt";
+  specs[1].command = "echo";
+  specs[1].option = "second";
+  specs[1].output_file = "batch_output.txt";
+  specs[2].argv = {"no_such_command_in_path"};
+  specs[3].argv = {"./batch_retry_tool"};
+  specs[3].output_file = "batch_output.txt";
+
+  int threads = 2;
+  std::vector<Subprocess> batch = Subprocess::SpawnBatch(specs, threads);
+  for (Subprocess& process : batch) {
+    EFLOG(DBG) << "pid " << process.GetPID() << " exit code: "
+               << process.SubprocessWait();
+  }
+
+  // both outputs went through one shared descriptor
+  char buffer[64] = {0};
+  ssize_t size = read(batch[0].GetOutputFD(), buffer, sizeof(buffer) - 1);
+  EFLOG(DBG) << "batch output: " << size << " bytes\n" << buffer;
+
+  // a failed command keeps its output file, even once the shared
+  // descriptor was closed and its number reused
+  EFCHECK(batch[3].GetPID() == -1);
+  int reused_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  FILE* fp = fopen("batch_retry_tool", "w");
+  fputs("#!/bin/sh\necho retried\n", fp);
+  fclose(fp);
+  chmod("batch_retry_tool", 0700);
+  EFCHECK(batch[3].Start() == 0 && batch[3].SubprocessWait() == 0);
+  close(reused_fd);
+  std::string output;
+  fp = fopen("batch_output.txt", "r");
+  while (fgets(buffer, sizeof(buffer), fp)) output += buffer;
+  fclose(fp);
+  EFCHECK(output.find("retried\n") != std::string::npos);
+  remove("batch_retry_tool");
+  remove("batch_output.txt");
+
+  // a file that can not be opened fails its command, nothing is started
+  std::vector<CommandSpec> unwritable(1);
+  unwritable[0].argv = {"echo", "lost"};
+  unwritable[0].output_file = "no_such_dir/batch_output.txt";
+  std::vector<Subprocess> failed = Subprocess::SpawnBatch(unwritable);
+  EFLOG(DBG) << "unwritable output: "
+             << strerror(failed[0].GetSpawnError());
+  EFCHECK(failed[0].GetPID() == -1 && failed[0].GetSpawnError() == ENOENT);
+}
+
+// TESTCASE 37 corresponding to USECASE 26
+void PathCacheTest() {
+  bool start_execution = false;
+  char cwd[PATH_MAX];
+  EFCHECK(getcwd(cwd, sizeof(cwd)) != nullptr);
+  std::string bin_dir = std::string(cwd) + "/path_cache_bin";
+  std::string tool = bin_dir + "/path_cache_tool";
+  std::string saved_path = getenv("PATH");
+  mkdir(bin_dir.c_str(), 0700);
+  // the helper keeps the old PATH, it can only exec the resolved file
+  SpawnServer::Instance().Start();
+  setenv("PATH", (bin_dir + ":" + saved_path).c_str(), 1);
+
+  // not found in the parent, no child is created
+  Subprocess missing_process("path_cache_tool", "", start_execution);
+  missing_process.Start();
+  EFLOG(DBG) << "pid " << missing_process.GetPID() << " spawn error: "
+             << strerror(missing_process.GetSpawnError());
+  EFCHECK(missing_process.GetSpawnError() == ENOENT);
+
+  // the new file invalidates the cached miss
+  FILE* fp = fopen(tool.c_str(), "w");
+  fputs("#!/bin/sh\necho found in PATH\n", fp);
+  fclose(fp);
+  chmod(tool.c_str(), 0700);
+  Subprocess tool_process("path_cache_tool", "", start_execution);
+  tool_process.Start();
+  EFLOG(DBG) << "spawn error: " << tool_process.GetSpawnError()
+             << ", exit code: " << tool_process.SubprocessWait();
+
+  // without #! the resolved file still runs through /bin/sh, as it does
+  // with execvp()
+  fp = fopen(tool.c_str(), "w");
+  fputs("echo no interpreter line\n", fp);
+  fclose(fp);
+  for (LaunchBackend backend : {kClone3, kVfork, kSpawnServer}) {
+    Subprocess script_process("path_cache_tool", "", start_execution);
+    script_process.SetLaunchBackend(backend);
+    CaptureResult result = script_process.RunAndCapture();
+    EFLOG(DBG) << "backend " << backend << ": " << result.output;
+    EFCHECK(result.exit_status == 0 &&
+            result.output == "no interpreter line\n");
+  }
+  SpawnServer::Instance().Stop();
+
+  setenv("PATH", saved_path.c_str(), 1);
+  remove(tool.c_str());
+  rmdir(bin_dir.c_str());
+}
+
+// TESTCASE 38 corresponding to USECASE 27
+void ExecFailureTest() {
+  bool start_execution = false;
+  const struct {
+    LaunchBackend backend;
+    const char* name;
+  } backends[] = {{kPosixSpawn, "posix_spawn"},
+                  {kClone3, "clone3"},
+                  {kVfork, "vfork"},
+                  {kSpawnServer, "spawn_server"}};
+
+  FILE* fp = fopen("not_executable.sh", "w");
+  fputs("#!/bin/sh\n", fp);
+  fclose(fp);
+
+  SpawnServer::Instance().Start();
+  for (const auto& b : backends) {
+    // the errno of the exec is known as soon as Start() returns
+    Subprocess missing_process("./no_such_tool", "", start_execution);
+    missing_process.SetLaunchBackend(b.backend);
+    int missing_error = missing_process.Start();
+
+    Subprocess denied_process("./not_executable.sh", "", start_execution);
+    denied_process.SetLaunchBackend(b.backend);
+    int denied_error = denied_process.Start();
+
+    EFLOG(DBG) << b.name << ": " << strerror(missing_error) << ", "
+               << strerror(denied_error) << ", pid "
+               << missing_process.GetPID();
+    EFCHECK(missing_error == ENOENT && denied_error == EACCES);
+    EFCHECK(missing_process.GetPID() == -1);
+  }
+  SpawnServer::Instance().Stop();
+  remove("not_executable.sh");
+}
+
+// cgroup2 mount point from /proc/self/mounts, empty if there is none
+std::string CgroupMount() {
+  FILE* fp = fopen("/proc/self/mounts", "r");
+  if (!fp) return std::string();
+  char device[256], dir[256], type[64];
+  std::string mount;
+  while (fscanf(fp, "%255s %255s %63s %*[^\n]", device, dir, type) == 3) {
+    if (strcmp(type, "cgroup2") == 0) {
+      mount = dir;
+      break;
+    }
+  }
+  fclose(fp);
+  return mount;
+}
+
+// TESTCASE 39 corresponding to USECASE 28
+void ResourceLimitTest() {
+  bool start_execution = false;
+  Subprocess limited_process(
+      "sh", "-c 'ulimit -n; nice; grep Cpus_allowed_list /proc/self/status'",
+      start_execution, kShellWords);
+  limited_process.SetResourceLimit(RLIMIT_NOFILE, 64, 64);
+  limited_process.SetNice(5);
+  limited_process.SetIoPriority(kIoPriorityIdle, 0);
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  limited_process.SetCpuAffinity(cpus);
+  EFLOG(DBG) << "start: " << limited_process.Start();
+  EFLOG(DBG) << "exit code: " << limited_process.SubprocessWait();
+
+  // a limit the child may not raise fails the launch
+  Subprocess denied_process("true", "", start_execution);
+  denied_process.SetNice(-20);
+  if (geteuid() != 0) {
+    EFCHECK(denied_process.Start() == EACCES);
+  }
+
+  std::string mount = CgroupMount();
+  std::string cgroup = mount + "/subprocess_test." + std::to_string(getpid());
+  if (mount.empty() || mkdir(cgroup.c_str(), 0755) != 0) {
+    EFLOG(DBG) << "no writable cgroup v2, cgroup placement skipped";
+    return;
+  }
+  Subprocess cgroup_process("cat", "/proc/self/cgroup", start_execution);
+  EFCHECK(cgroup_process.SetCgroup(cgroup));
+  EFLOG(DBG) << "start: " << cgroup_process.Start();
+  EFLOG(DBG) << "exit code: " << cgroup_process.SubprocessWait();
+  CgroupUsage usage;
+  if (cgroup_process.GetCgroupUsage(&usage)) {
+    EFLOG(DBG) << "cgroup cpu: " << usage.cpu_usec << " us, memory peak: "
+               << usage.memory_peak;
+  }
+  rmdir(cgroup.c_str());
+}
+
+// TESTCASE 40 corresponding to USECASE 29
+void ExitInfoTest() {
+  bool start_execution = false;
+  Subprocess busy_process("sh", "-c 'head -c 4000000 /dev/urandom | wc -c'",
+                          start_execution, kShellWords);
+  busy_process.SendOutputToFile(nullptr);
+  busy_process.Start();
+  ExitInfo info = busy_process.WaitForExit();
+  EFLOG(DBG) << "exit code: " << info.exit_code << ", signal: "
+             << info.signal << ", user: " << info.user_time.count()
+             << " us, system: " << info.system_time.count()
+             << " us, max rss: " << info.max_rss_kb << " kB, faults: "
+             << info.minor_faults << "/" << info.major_faults
+             << ", switches: " << info.voluntary_switches << "/"
+             << info.involuntary_switches;
+  EFLOG(DBG) << "spawn: " << info.spawn_time.count() << " ns, exec: "
+             << info.exec_time.count() << " ns, run: "
+             << info.run_time.count() << " ns, reap: "
+             << info.reap_time.count() << " ns";
+  EFCHECK(info.exit_code == 0 && info.signal == 0);
+
+  // a signal is no longer mistaken for an exit code
+  Subprocess killed_process("sh", "-c 'kill -TERM $$'", start_execution,
+                            kShellWords);
+  killed_process.Start();
+  info = killed_process.WaitForExit();
+  EFLOG(DBG) << "exit code: " << info.exit_code << ", signal: "
+             << info.signal;
+  EFCHECK(info.exit_code == -1 && info.signal == SIGTERM);
+  EFCHECK(killed_process.WaitForExit().error == ECHILD);
+}
+
+// value of "key" in one event line of a Chrome trace, "" if absent
+static std::string TraceField(const std::string& event,
+                              const std::string& key) {
+  std::string pattern = "\"" + key + "\":";
+  size_t begin = event.find(pattern);
+  if (begin == std::string::npos) return "";
+  begin += pattern.size();
+  if (event[begin] == '"') {
+    size_t end = event.find('"', begin + 1);
+    return event.substr(begin + 1, end - begin - 1);
+  }
+  return event.substr(begin, event.find_first_of(",}", begin) - begin);
+}
+
+// TESTCASE 41 corresponding to USECASE 30
+void TraceTest() {
+  bool start_execution = false;
+  SubprocessMetrics metrics;
+  SubprocessTrace::SetObserver(&metrics);
+
+  Subprocess cat_process("cat", "", start_execution);
+  CaptureResult result = cat_process.CommunicateWithInput("traced\n");
+  Subprocess missing_process("./no_such_tool", "", start_execution);
+  missing_process.Start();
+
+  SubprocessTrace::SetObserver(nullptr);
+  EFLOG(DBG) << "exit code: " << result.exit_status << "\n"
+             << metrics.Summary();
+  EFCHECK(metrics.Spawns() == 2 && metrics.SpawnFailures() == 1);
+  EFCHECK(metrics.StreamBytes(STDOUT_FILENO).Sum() == 7);
+
+  // events of the next children go to a Chrome trace file, one waited
+  // for by WaitForExit() and one reaped by a reactor
+  pid_t reactor_pid = -1;
+  {
+    ChromeTraceWriter writer("subprocess_trace.json");
+    SubprocessTrace::SetObserver(&writer);
+    Subprocess echo_process("echo", "traced", start_execution);
+    echo_process.SendOutputToFile(nullptr);
+    echo_process.Start();
+    echo_process.WaitForExit();
+
+    Subprocess true_process("true", "", start_execution);
+    true_process.Start();
+    reactor_pid = true_process.GetPID();
+    SubprocessReactor reactor;
+    EFCHECK(reactor.Watch(true_process, nullptr));
+    reactor.Run();
+    SubprocessTrace::SetObserver(nullptr);
+  }
+
+  // every spawn span ends on its thread, every child run span ends
+  FILE* fp = fopen("subprocess_trace.json", "r");
+  EFCHECK(fp != nullptr);
+  char line[512] = {0};
+  EFCHECK(fgets(line, sizeof(line), fp) &&
+          std::string(line) == "{\"traceEvents\":[\n");
+  std::map<std::string, std::string> open_spawns;  // tid to B ts
+  std::map<std::string, std::string> open_runs;    // id to b ts
+  std::set<std::string> ended_runs;
+  int spawns = 0;
+  bool closed = false;
+  while (fgets(line, sizeof(line), fp)) {
+    std::string event(line);
+    EFLOG(DBG) << "trace: " << event;
+    if (event == "]}\n") {
+      closed = true;
+      break;
+    }
+    std::string name = TraceField(event, "name");
+    std::string phase = TraceField(event, "ph");
+    double ts = atof(TraceField(event, "ts").c_str());
+    if (name == "spawn") {
+      std::string tid = TraceField(event, "tid");
+      if (phase == "B") {
+        EFCHECK(open_spawns.count(tid) == 0);
+        open_spawns[tid] = TraceField(event, "ts");
+      } else {
+        EFCHECK(phase == "E" && open_spawns.count(tid) == 1);
+        EFCHECK(atof(open_spawns[tid].c_str()) <= ts);
+        open_spawns.erase(tid);
+        ++spawns;
+      }
+    } else if (name == "run") {
+      std::string id = TraceField(event, "id");
+      if (phase == "b") {
+        EFCHECK(open_runs.count(id) == 0);
+        open_runs[id] = TraceField(event, "ts");
+      } else {
+        EFCHECK(phase == "e" && open_runs.count(id) == 1);
+        EFCHECK(atof(open_runs[id].c_str()) <= ts);
+        open_runs.erase(id);
+        ended_runs.insert(id);
+      }
+    }
+  }
+  fclose(fp);
+  remove("subprocess_trace.json");
+  EFCHECK(closed && spawns == 2 && ended_runs.size() == 2);
+  EFCHECK(open_spawns.empty() && open_runs.empty());
+  EFCHECK(ended_runs.count(std::to_string(reactor_pid)) == 1);
+}
+
+// TESTCASE 42 corresponding to USECASE 31
+void RecordReaderTest() {
+  bool start_execution = false;
+  Subprocess printf_process(
+      "printf", "'first\\nsecond line that outgrows the buffer\\n\\nlast'",
+      start_execution, kShellWords);
+  printf_process.SendOutputToPipe();
+  printf_process.Start();
+
+  // a tiny buffer makes the long record grow it
+  RecordReader reader(printf_process.GetOutputFD(), '\n', 8);
+  std::vector<std::string> records;
+  RecordView record;
+  RecordReader::Status status;
+  while ((status = reader.Next(&record)) == RecordReader::kRecord) {
+    EFLOG(DBG) << "record: [" << record.ToString() << "]\n";
+    records.push_back(record.ToString());
+  }
+  printf_process.SubprocessWait();
+
+  EFCHECK(status == RecordReader::kEndOfStream && reader.Count() == 4);
+  EFCHECK(records[0] == "first" && records[2].empty());
+  EFCHECK(records[1] == "second line that outgrows the buffer");
+  EFCHECK(records[3] == "last");
+}
+
+// TESTCASE 43 corresponding to USECASE 32
+void TimeoutTest() {
+  bool start_execution = false;
+  TimeoutPolicy policy;
+  policy.grace_period = std::chrono::milliseconds(100);
+
+  // exits before the deadline, nothing is signalled
+  Subprocess true_process("true", "", start_execution);
+  ExitInfo info = true_process.RunWithTimeout(std::chrono::seconds(5));
+  EFCHECK(!info.timed_out && info.exit_code == 0);
+
+  // SIGTERM is enough
+  Subprocess sleep_process("sleep", "30", start_execution);
+  info = sleep_process.RunWithTimeout(std::chrono::milliseconds(100),
+                                      policy);
+  EFLOG(DBG) << "timed out: " << info.timed_out << ", killed: "
+             << info.killed << ", signal: " << info.signal << "\n";
+  EFCHECK(info.timed_out && !info.killed && info.signal == SIGTERM);
+
+  // started here, signal_group puts the child in a group of its own
+  Subprocess group_process("sh", "-c 'cut -d \" \" -f 5 /proc/$$/stat'",
+                           start_execution, kShellWords);
+  group_process.SendOutputToPipe();
+  info = group_process.RunWithTimeout(std::chrono::seconds(5));
+  EFCHECK(!info.timed_out && info.exit_code == 0);
+  char group_id[32] = {0};
+  EFCHECK(read(group_process.GetOutputFD(), group_id, sizeof(group_id) - 1) >
+          0);
+  EFCHECK(atoi(group_id) == group_process.GetPID());
+
+  // a shell ignoring SIGTERM with a grandchild that inherits that
+  Subprocess shell_process(
+      "sh", "-c 'trap \"\" TERM; sleep 30 & echo $!; wait'",
+      start_execution, kShellWords);
+  shell_process.SetProcessGroup(kNewProcessGroup);
+  shell_process.SendOutputToPipe();
+  shell_process.Start();
+  EFCHECK(getpgid(shell_process.GetPID()) == shell_process.GetPID());
+
+  RecordReader reader(shell_process.GetOutputFD());
+  RecordView line;
+  EFCHECK(reader.Next(&line) == RecordReader::kRecord);
+  pid_t grandchild = atoi(line.ToString().c_str());
+  int grandchild_pidfd = syscall(SYS_pidfd_open, grandchild, 0);
+  EFCHECK(grandchild_pidfd != -1);
+
+  info = shell_process.RunWithTimeout(std::chrono::milliseconds(100),
+                                      policy);
+  EFLOG(DBG) << "timed out: " << info.timed_out << ", killed: "
+             << info.killed << ", signal: " << info.signal << "\n";
+  EFCHECK(info.timed_out && info.killed && info.signal == SIGKILL);
+
+  // the grandchild got the SIGKILL of the group as well
+  struct pollfd poll_fd = {grandchild_pidfd, POLLIN, 0};
+  EFCHECK(poll(&poll_fd, 1, 5000) == 1);
+  close(grandchild_pidfd);
+}
+
+// TESTCASE 44 corresponding to USECASE 33
+void EnvironmentTest() {
+  bool start_execution = false;
+  std::shared_ptr<const Environment> environment =
+      EnvironmentBuilder::FromParent()
+          .Set("SUBPROCESS_TEST", "first")
+          .Set("SUBPROCESS_TEST", "value")
+          .Unset("HOME")
+          .Build();
+  EFCHECK(environment->Get("HOME") == nullptr);
+  EFCHECK(std::string(environment->Get("SUBPROCESS_TEST")) == "value");
+
+  // the same block for every backend, the directory as path or dirfd
+  int root_fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  LaunchBackend backends[] = {kPosixSpawn, kClone3, kVfork, kSpawnServer};
+  for (LaunchBackend backend : backends) {
+    Subprocess sh_process(
+        "sh", "-c 'echo \"$SUBPROCESS_TEST ${HOME-unset} $(pwd -P)\"'",
+        start_execution, kShellWords);
+    sh_process.SetLaunchBackend(backend);
+    sh_process.SetEnvironment(environment);
+    if (backend == kClone3) {
+      sh_process.SetWorkingDirectory(root_fd);
+    } else {
+      sh_process.SetWorkingDirectory("/");
+    }
+    CaptureResult result = sh_process.RunAndCapture();
+    EFLOG(DBG) << "backend " << backend << ": " << result.output;
+    EFCHECK(result.exit_status == 0 && result.output == "value unset /\n");
+  }
+  close(root_fd);
+
+  // the executable is searched in the PATH of the child
+  Subprocess true_process("true", "", start_execution);
+  true_process.SetEnvironment(
+      EnvironmentBuilder().Set("PATH", "/nonexistent").Build());
+  EFCHECK(true_process.Start() == ENOENT);
+
+  Subprocess missing_dir_process("true", "", start_execution);
+  missing_dir_process.SetWorkingDirectory("/nonexistent");
+  EFCHECK(missing_dir_process.Start() == ENOENT);
+}
+
+// TESTCASE 45 corresponding to USECASE 34
+void TailCaptureTest() {
+  bool start_execution = false;
+
+  // 1 MB of stderr, only the last 4 KB are kept
+  Subprocess noisy_process(
+      "sh", "-c 'head -c 1000000 /dev/zero | tr \"\\000\" a >&2; "
+            "echo END >&2'",
+      start_execution, kShellWords);
+  noisy_process.SendErrorToTail(4096);
+  std::shared_ptr<TailCapture> tail = noisy_process.GetErrorTail();
+  noisy_process.Start();
+  noisy_process.WaitForExit();
+  tail->Wait();
+
+  std::string snapshot = tail->Snapshot();
+  EFLOG(DBG) << "total: " << tail->TotalBytes() << ", kept: "
+             << snapshot.size() << ", end: " << snapshot.substr(4090);
+  EFCHECK(tail->Finished() && tail->TotalBytes() == 1000004);
+  EFCHECK(snapshot.size() == 4096 && snapshot.substr(4092) == "END\n");
+  EFCHECK(snapshot.find_first_not_of('a') == 4092);
+
+  // snapshots from another thread while the child keeps writing
+  Subprocess endless_process("sh", "-c 'while :; do echo line; done >&2'",
+                             start_execution, kShellWords);
+  endless_process.SendErrorToTail(1000);
+  tail = endless_process.GetErrorTail();
+  endless_process.Start();
+  std::thread reader([&tail] {
+    size_t snapshots = 0;
+    while (snapshots < 100) {
+      std::string lines = tail->Snapshot();
+      if (lines.size() < tail->TotalBytes() && lines.size() == 1024) {
+        // whole lines after the first, which may be cut
+        size_t first = lines.find('\n') + 1;
+        for (size_t i = first; i + 5 <= lines.size(); i += 5) {
+          EFCHECK(lines.compare(i, 5, "line\n") == 0);
+        }
+        ++snapshots;
+      }
+    }
+  });
+  reader.join();
+  endless_process.SubprocessKill();
+  endless_process.WaitForExit();
+  EFLOG(DBG) << "\ntotal while running: " << tail->TotalBytes();
+}
+
+// Feed a cat child through pipes and read its output until EOF, false if
+// EOF does not come within timeout_ms because a pipe end leaked
+static bool CatRoundTrip(int timeout_ms) {
+  bool start_execution = false;
+  Subprocess cat_process("cat", "", start_execution);
+  cat_process.ReceiveInputFromPipe();
+  cat_process.SendOutputToPipe();
+  if (cat_process.Start() != 0) return false;
+
+  const char message[] = "ping\n";
+  bool written = write(cat_process.GetInputFD(), message,
+                       sizeof(message) - 1) == sizeof(message) - 1;
+  cat_process.CloseInput();
+
+  std::string output;
+  struct pollfd poll_fd = {cat_process.GetOutputFD(), POLLIN, 0};
+  bool eof = false;
+  while (!eof && poll(&poll_fd, 1, timeout_ms) == 1) {
+    char buffer[64];
+    ssize_t size = read(poll_fd.fd, buffer, sizeof(buffer));
+    if (size > 0) output.append(buffer, size);
+    eof = size <= 0;
+  }
+  if (!eof) cat_process.SubprocessKill();
+  cat_process.WaitForExit();
+  return written && eof && output == message;
+}
+
+// TESTCASE 46 corresponding to USECASE 35
+void ConcurrentSpawnTest() {
+  bool start_execution = false;
+
+  // only the inherited fd gets through, under the same number
+  int channel[2];
+  EFCHECK(pipe2(channel, O_CLOEXEC) == 0);
+  int unrelated_fd = open("/dev/null", O_RDONLY);
+  Subprocess sh_process(
+      "sh", "-c 'echo inherited >&" + std::to_string(channel[1]) +
+                "; test -e /proc/self/fd/" + std::to_string(unrelated_fd) +
+                " && echo leaked >&" + std::to_string(channel[1]) + "'",
+      start_execution, kShellWords);
+  sh_process.InheritFD(channel[1]);
+  EFCHECK(sh_process.Start() == 0);
+  close(channel[1]);
+  sh_process.SubprocessWait();
+  char buffer[64] = {0};
+  EFCHECK(read(channel[0], buffer, sizeof(buffer) - 1) > 0);
+  EFLOG(DBG) << "child wrote: " << buffer;
+  EFCHECK(std::string(buffer) == "inherited\n");
+  close(channel[0]);
+  close(unrelated_fd);
+
+  // 64 threads spawning at once, every reader must see its EOF
+  const int kThreads = 64, kRounds = 5;
+  for (int threads = 1; threads <= kThreads; threads *= kThreads) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> workers;
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&failures, threads] {
+        for (int round = 0; round < kRounds * kThreads / threads; ++round) {
+          if (!CatRoundTrip(10000)) ++failures;
+        }
+      });
+    }
+    for (std::thread& worker : workers) worker.join();
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - begin).count();
+    EFLOG(DBG) << "\n" << threads << " threads: "
+               << kRounds * kThreads / seconds << " round trips/s, "
+               << failures << " failures\n";
+    EFCHECK(failures == 0);
+  }
+}
+
+// TESTCASE 47 corresponding to USECASE 36
+void ChildRegistryTest() {
+  bool start_execution = false;
+
+  // a waitpid(-1) loop elsewhere in the process must not steal the child
+  Subprocess registered("sh", "-c 'sleep 0.2; exit 3'", start_execution,
+                        kShellWords);
+  registered.UseChildRegistry();
+  registered.SetProcessGroup(kNewProcessGroup);
+  EFCHECK(registered.Start() == 0);
+  auto steal_until =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(400);
+  while (std::chrono::steady_clock::now() < steal_until) {
+    EFCHECK(waitpid(-1, nullptr, WNOHANG) != registered.GetPID());
+    usleep(1000);
+  }
+  EFCHECK(ChildRegistry::Instance().Pending() == 0);
+  EFCHECK(registered.SubprocessWait() == 3);
+  EFCHECK(registered.SubprocessWait() == -1);
+  // the group id of a reaped leader may have been reused
+  EFCHECK(registered.SubprocessKill() == -1 && errno == ESRCH);
+
+  // many waiters on one slot are all woken by the exit
+  Subprocess shared("sh", "-c 'sleep 0.1; exit 5'", start_execution,
+                    kShellWords);
+  shared.SetLaunchBackend(kClone3);
+  EFCHECK(shared.Start() == 0);
+  // the registry takes the descriptor over instead of duplicating it
+  ScopedFD pidfd;
+  pidfd.Reset(syscall(SYS_pidfd_open, shared.GetPID(), 0));
+  EFCHECK(pidfd.valid());
+  int pidfd_number = pidfd.get();
+  std::shared_ptr<const ExitSlot> slot =
+      ChildRegistry::Instance().Register(shared.GetPID(), &pidfd);
+  EFCHECK(slot != nullptr);
+  EFCHECK(!pidfd.valid() && slot->pidfd() == pidfd_number);
+  std::atomic<int> woken(0);
+  std::vector<std::thread> waiters;
+  for (int i = 0; i < 8; ++i) {
+    waiters.emplace_back([&slot, &woken] {
+      if (slot->Wait() == ExitSlot::kExited) ++woken;
+    });
+  }
+  for (std::thread& waiter : waiters) waiter.join();
+  EFCHECK(woken == 8);
+  EFCHECK(WIFEXITED(slot->wait_status()) &&
+          WEXITSTATUS(slot->wait_status()) == 5);
+
+  // the status of a child reaped behind our back is an error, not a crash
+  Subprocess unregistered("true", "", start_execution);
+  EFCHECK(unregistered.Start() == 0);
+  EFCHECK(waitpid(unregistered.GetPID(), nullptr, 0) ==
+          unregistered.GetPID());
+  EFCHECK(unregistered.SubprocessWait() == -1);
+  // exited or doesn't exist
+  EFCHECK(unregistered.SubprocessWaitForGivenTime(1) ==
+          Subprocess::kChildNotExist);
+}
+
 int main() {
   clock_t clk_start, clk_end;
   clk_start = clock();
@@ -471,6 +1632,78 @@ int main() {
   EFLOG(DBG) << "\nTEST 23: WaitAfterSleep\n";
   WaitAfterSleep();
 
+  EFLOG(DBG) << "\nTEST 24: LaunchBackends\n";
+  LaunchBackends();
+
+  EFLOG(DBG) << "\nTEST 25: SubSecondWaitFor\n";
+  SubSecondWaitFor();
+
+  EFLOG(DBG) << "\nTEST 26: ReactorTest\n";
+  ReactorTest();
+
+  EFLOG(DBG) << "\nTEST 27: CaptureInMemory\n";
+  CaptureInMemory();
+
+  EFLOG(DBG) << "\nTEST 28: PipelineTest\n";
+  PipelineTest();
+
+  EFLOG(DBG) << "\nTEST 29: ZeroCopyTest\n";
+  ZeroCopyTest();
+
+  EFLOG(DBG) << "\nTEST 30: SpawnServerTest\n";
+  SpawnServerTest();
+
+  EFLOG(DBG) << "\nTEST 31: PoolTest\n";
+  PoolTest();
+
+  EFLOG(DBG) << "\nTEST 32: ArgvConstruction\n";
+  ArgvConstruction();
+
+  EFLOG(DBG) << "\nTEST 33: DescriptorLeakStress\n";
+  DescriptorLeakStress();
+
+  EFLOG(DBG) << "\nTEST 34: ReadinessTest\n";
+  ReadinessTest();
+
+  EFLOG(DBG) << "\nTEST 35: UringTest\n";
+  UringTest();
+
+  EFLOG(DBG) << "\nTEST 36: BatchSpawnTest\n";
+  BatchSpawnTest();
+
+  EFLOG(DBG) << "\nTEST 37: PathCacheTest\n";
+  PathCacheTest();
+
+  EFLOG(DBG) << "\nTEST 38: ExecFailureTest\n";
+  ExecFailureTest();
+
+  EFLOG(DBG) << "\nTEST 39: ResourceLimitTest\n";
+  ResourceLimitTest();
+
+  EFLOG(DBG) << "\nTEST 40: ExitInfoTest\n";
+  ExitInfoTest();
+
+  EFLOG(DBG) << "\nTEST 41: TraceTest\n";
+  TraceTest();
+
+  EFLOG(DBG) << "\nTEST 42: RecordReaderTest\n";
+  RecordReaderTest();
+
+  EFLOG(DBG) << "\nTEST 43: TimeoutTest\n";
+  TimeoutTest();
+
+  EFLOG(DBG) << "\nTEST 44: EnvironmentTest\n";
+  EnvironmentTest();
+
+  EFLOG(DBG) << "\nTEST 45: TailCaptureTest\n";
+  TailCaptureTest();
+
+  EFLOG(DBG) << "\nTEST 46: ConcurrentSpawnTest\n";
+  ConcurrentSpawnTest();
+
+  EFLOG(DBG) << "\nTEST 47: ChildRegistryTest\n";
+  ChildRegistryTest();
+
   clk_end = clock();
   EFLOG(DBG) << "Total time " << (clk_end - clk_start);
 